@@ -0,0 +1,95 @@
+/*
+    Compile a gene regulatory network model against a matrix directory.
+    Copyright (C) 2008-2009  Andrew Miller
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <boost/program_options.hpp>
+#include <boost/filesystem.hpp>
+#include <iostream>
+#include "SVMSupport.hpp"
+
+namespace po = boost::program_options;
+namespace fs = boost::filesystem;
+
+int
+main(int argc, char** argv)
+{
+  po::options_description desc;
+  std::string matrixdir, model, output;
+
+  desc.add_options()
+    ("matrixdir", po::value<std::string>(&matrixdir),
+     "The directory set up by SOFT2Matrix")
+    ("model", po::value<std::string>(&model),
+     "The gene regulatory network model, in the text format")
+    ("output", po::value<std::string>(&output),
+     "The file to write the compiled model to, which can be given as the "
+     "model to the other tools when they use the same matrixdir")
+    ;
+
+  po::variables_map vm;
+
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  std::string wrong;
+  if (!vm.count("help"))
+  {
+    if (!vm.count("matrixdir"))
+      wrong = "matrixdir";
+    else if (!vm.count("model"))
+      wrong = "model";
+    else if (!vm.count("output"))
+      wrong = "output";
+  }
+
+  if (wrong != "")
+    std::cerr << "Missing option: " << wrong << std::endl;
+  if (vm.count("help") || wrong != "")
+  {
+    std::cout << desc << std::endl;
+    return 1;
+  }
+
+  if (!fs::is_directory(matrixdir))
+  {
+    std::cout << "Matrix directory doesn't exist."
+              << std::endl;
+    return 1;
+  }
+
+  if (!fs::is_regular(model))
+  {
+    std::cout << "Model file doesn't exist or not regular file."
+              << std::endl;
+    return 1;
+  }
+
+  ExpressionMatrixProcessor emp(matrixdir,
+                                ExpressionMatrixProcessor::kStreamedAccess);
+  GRNModel m(model, emp);
+
+  std::string temporary(output + ".tmp");
+  if (!m.saveCompiledModel(temporary))
+  {
+    std::cout << "Couldn't write " << temporary << std::endl;
+    fs::remove(temporary);
+    return 1;
+  }
+
+  fs::rename(temporary, output);
+
+  return 0;
+}
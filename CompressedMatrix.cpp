@@ -0,0 +1,391 @@
+/*
+    Block-compressed copy of an expression matrix
+    Copyright (C) 2008-2009  Andrew Miller
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "CompressedMatrix.hpp"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+
+using namespace CompressedMatrixFormat;
+
+// About how much uncompressed data goes in each chunk. Smaller chunks waste
+// less work on random access, larger ones compress better.
+static const size_t kChunkBytes = 1 << 20;
+// How many chunks are kept decompressed, and how many of them the
+// background thread may get ahead of the reader by.
+static const size_t kCachedChunks = 8;
+static const size_t kReadAhead = 2;
+static const uint32_t kNoChunk = 0xFFFFFFFF;
+
+static bool
+readFully(int aFD, void* aBuffer, size_t aSize, uint64_t aOffset)
+{
+  char* p = static_cast<char*>(aBuffer);
+  while (aSize > 0)
+  {
+    ssize_t n = pread(aFD, p, aSize, aOffset);
+    if (n <= 0)
+      return false;
+    p += n;
+    aSize -= n;
+    aOffset += n;
+  }
+  return true;
+}
+
+CompressedMatrixWriter::CompressedMatrixWriter
+(
+ const std::string& aFilename,
+ uint32_t anGenes,
+ uint32_t anArrays
+)
+  : mnGenes(anGenes), mnArrays(anArrays), mnBuffered(0)
+{
+  size_t rowBytes = std::max(static_cast<size_t>(mnGenes), static_cast<size_t>(1)) *
+    sizeof(double);
+  mArraysPerChunk = std::max(kChunkBytes / rowBytes, static_cast<size_t>(1));
+  mBuffer.resize(static_cast<size_t>(mArraysPerChunk) * mnGenes);
+
+  mFile = fopen(aFilename.c_str(), "w");
+  if (mFile == NULL)
+    return;
+
+  // The index is filled in by finish(), once the chunk sizes are known.
+  uint32_t nChunks = (mnArrays + mArraysPerChunk - 1) / mArraysPerChunk;
+  std::vector<uint64_t> index(nChunks + 1, 0);
+  Header h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.mMagic, kMagic, sizeof(kMagic));
+  h.mVersion = kVersion;
+  h.mnGenes = mnGenes;
+  h.mnArrays = mnArrays;
+  h.mArraysPerChunk = mArraysPerChunk;
+  h.mnChunks = nChunks;
+  h.mValueSize = sizeof(double);
+
+  if (fwrite(&h, sizeof(h), 1, mFile) != 1 ||
+      fwrite(&index[0], sizeof(uint64_t), index.size(), mFile) !=
+      index.size())
+  {
+    fclose(mFile);
+    mFile = NULL;
+    return;
+  }
+
+  mOffsets.push_back(sizeof(h) + sizeof(uint64_t) * index.size());
+}
+
+CompressedMatrixWriter::~CompressedMatrixWriter()
+{
+  if (mFile != NULL)
+    fclose(mFile);
+}
+
+bool
+CompressedMatrixWriter::writeArray(const double* aRow)
+{
+  if (mFile == NULL)
+    return false;
+
+  std::copy(aRow, aRow + mnGenes,
+            mBuffer.begin() + static_cast<size_t>(mnBuffered) * mnGenes);
+  if (++mnBuffered < mArraysPerChunk)
+    return true;
+
+  return writeChunk();
+}
+
+bool
+CompressedMatrixWriter::writeChunk()
+{
+  size_t values = static_cast<size_t>(mnBuffered) * mnGenes,
+    bytes = values * sizeof(double);
+  mnBuffered = 0;
+  if (bytes == 0)
+  {
+    mOffsets.push_back(mOffsets.back());
+    return true;
+  }
+
+  std::vector<unsigned char> shuffled(bytes);
+  const unsigned char* in = reinterpret_cast<const unsigned char*>(&mBuffer[0]);
+  for (size_t b = 0; b < sizeof(double); b++)
+  {
+    unsigned char* out = &shuffled[b * values];
+    for (size_t i = 0; i < values; i++)
+      out[i] = in[i * sizeof(double) + b];
+  }
+
+  uLongf packedSize = compressBound(bytes);
+  std::vector<unsigned char> packed(packedSize);
+  if (compress2(&packed[0], &packedSize, &shuffled[0], bytes,
+                Z_DEFAULT_COMPRESSION) != Z_OK ||
+      fwrite(&packed[0], packedSize, 1, mFile) != 1)
+    return false;
+
+  mOffsets.push_back(mOffsets.back() + packedSize);
+  return true;
+}
+
+bool
+CompressedMatrixWriter::finish()
+{
+  if (mFile == NULL)
+    return false;
+
+  bool ok = (mnBuffered == 0 || writeChunk());
+  uint32_t nChunks = (mnArrays + mArraysPerChunk - 1) / mArraysPerChunk;
+  ok = ok && (mOffsets.size() == nChunks + 1) &&
+    fseek(mFile, sizeof(Header), SEEK_SET) == 0 &&
+    fwrite(&mOffsets[0], sizeof(uint64_t), mOffsets.size(), mFile) ==
+    mOffsets.size();
+
+  if (fclose(mFile) != 0)
+    ok = false;
+  mFile = NULL;
+
+  return ok;
+}
+
+CompressedMatrix::CompressedMatrix(const std::string& aFilename)
+  : mDecoding(kNoChunk), mDecoded(0), mConsumed(0), mStop(false),
+    mThread(NULL)
+{
+  memset(&mHeader, 0, sizeof(mHeader));
+  mFD = open(aFilename.c_str(), O_RDONLY);
+  if (mFD < 0)
+    return;
+
+  bool ok = readFully(mFD, &mHeader, sizeof(mHeader), 0) &&
+    memcmp(mHeader.mMagic, kMagic, sizeof(kMagic)) == 0 &&
+    mHeader.mVersion == kVersion && mHeader.mValueSize == sizeof(double) &&
+    mHeader.mArraysPerChunk != 0 &&
+    mHeader.mnChunks == (mHeader.mnArrays + mHeader.mArraysPerChunk - 1) /
+    mHeader.mArraysPerChunk;
+
+  if (ok)
+  {
+    mOffsets.resize(mHeader.mnChunks + 1);
+    ok = readFully(mFD, &mOffsets[0], sizeof(uint64_t) * mOffsets.size(),
+                   sizeof(mHeader));
+  }
+
+  if (!ok)
+  {
+    std::cerr << aFilename << " isn't a compressed matrix this version can "
+              << "read." << std::endl;
+    close(mFD);
+    mFD = -1;
+  }
+}
+
+CompressedMatrix::~CompressedMatrix()
+{
+  stopPrefetching();
+  if (mFD >= 0)
+    close(mFD);
+}
+
+CompressedMatrix::Chunk
+CompressedMatrix::decode(uint32_t aChunk) const
+{
+  uint32_t first = aChunk * mHeader.mArraysPerChunk;
+  size_t values = static_cast<size_t>(std::min(mHeader.mArraysPerChunk,
+                                               mHeader.mnArrays - first)) *
+    mHeader.mnGenes, bytes = values * sizeof(double);
+
+  Chunk data(new std::vector<double>(values));
+  if (values == 0)
+    return data;
+
+  std::vector<unsigned char> packed(mOffsets[aChunk + 1] - mOffsets[aChunk]),
+    shuffled(bytes);
+  uLongf size = bytes;
+  if (packed.empty() ||
+      !readFully(mFD, &packed[0], packed.size(), mOffsets[aChunk]) ||
+      uncompress(&shuffled[0], &size, &packed[0], packed.size()) != Z_OK ||
+      size != bytes)
+  {
+    std::cerr << "Chunk " << aChunk << " of the compressed matrix is "
+              << "damaged; its arrays will be missing." << std::endl;
+    std::fill(data->begin(), data->end(),
+              std::numeric_limits<double>::quiet_NaN());
+    return data;
+  }
+
+  unsigned char* out = reinterpret_cast<unsigned char*>(&(*data)[0]);
+  for (size_t b = 0; b < sizeof(double); b++)
+  {
+    const unsigned char* in = &shuffled[b * values];
+    for (size_t i = 0; i < values; i++)
+      out[i * sizeof(double) + b] = in[i];
+  }
+
+  return data;
+}
+
+// Must be called with mMutex held.
+void
+CompressedMatrix::insert(uint32_t aChunk, const Chunk& aData)
+{
+  mRecent.remove(aChunk);
+  mRecent.push_front(aChunk);
+  mCache[aChunk] = aData;
+
+  while (mRecent.size() > kCachedChunks)
+  {
+    mCache.erase(mRecent.back());
+    mRecent.pop_back();
+  }
+}
+
+CompressedMatrix::Chunk
+CompressedMatrix::getChunk(uint32_t aChunk)
+{
+  boost::unique_lock<boost::mutex> lock(mMutex);
+  Chunk data;
+
+  while (true)
+  {
+    std::map<uint32_t, Chunk>::iterator i = mCache.find(aChunk);
+    if (i != mCache.end())
+    {
+      data = i->second;
+      mRecent.remove(aChunk);
+      mRecent.push_front(aChunk);
+      break;
+    }
+
+    if (mDecoding != aChunk)
+    {
+      lock.unlock();
+      data = decode(aChunk);
+      lock.lock();
+      insert(aChunk, data);
+      break;
+    }
+
+    mChanged.wait(lock);
+  }
+
+  if (mConsumed < mSequence.size() && mSequence[mConsumed] == aChunk)
+  {
+    mConsumed++;
+    mChanged.notify_all();
+  }
+
+  return data;
+}
+
+void
+CompressedMatrix::readArray(uint32_t aArray, double* aRow)
+{
+  uint32_t nGenes = mHeader.mnGenes;
+  if (aArray >= mHeader.mnArrays)
+  {
+    std::fill(aRow, aRow + nGenes, std::numeric_limits<double>::quiet_NaN());
+    return;
+  }
+
+  uint32_t c = aArray / mHeader.mArraysPerChunk;
+  Chunk data(getChunk(c));
+  size_t offset = static_cast<size_t>(aArray - c * mHeader.mArraysPerChunk) *
+    nGenes;
+  std::copy(data->begin() + offset, data->begin() + offset + nGenes, aRow);
+}
+
+void
+CompressedMatrix::stopPrefetching()
+{
+  if (mThread == NULL)
+    return;
+
+  {
+    boost::unique_lock<boost::mutex> lock(mMutex);
+    mStop = true;
+    mChanged.notify_all();
+  }
+  mThread->join();
+  delete mThread;
+  mThread = NULL;
+}
+
+void
+CompressedMatrix::prefetch(const std::vector<uint32_t>& aArrays)
+{
+  stopPrefetching();
+
+  boost::unique_lock<boost::mutex> lock(mMutex);
+  mSequence.clear();
+  for (std::vector<uint32_t>::const_iterator i = aArrays.begin();
+       i != aArrays.end();
+       i++)
+  {
+    if (*i >= mHeader.mnArrays)
+      continue;
+    uint32_t c = *i / mHeader.mArraysPerChunk;
+    if (mSequence.empty() || mSequence.back() != c)
+      mSequence.push_back(c);
+  }
+  mDecoded = 0;
+  mConsumed = 0;
+  mStop = false;
+
+  if (!mSequence.empty())
+    mThread = new boost::thread(boost::bind(&CompressedMatrix::prefetchLoop,
+                                            this));
+}
+
+void
+CompressedMatrix::prefetchLoop()
+{
+  boost::unique_lock<boost::mutex> lock(mMutex);
+
+  while (!mStop && mDecoded < mSequence.size())
+  {
+    // Don't redo chunks the reader has already got to itself.
+    mDecoded = std::max(mDecoded, mConsumed);
+    if (mDecoded >= mSequence.size())
+      break;
+
+    if (mDecoded >= mConsumed + kReadAhead)
+    {
+      mChanged.wait(lock);
+      continue;
+    }
+
+    uint32_t c = mSequence[mDecoded];
+    if (mCache.find(c) == mCache.end())
+    {
+      mDecoding = c;
+      lock.unlock();
+      Chunk data(decode(c));
+      lock.lock();
+      insert(c, data);
+      mDecoding = kNoChunk;
+      mChanged.notify_all();
+    }
+    mDecoded++;
+  }
+}
@@ -0,0 +1,136 @@
+/*
+    Block-compressed copy of an expression matrix
+    Copyright (C) 2008-2009  Andrew Miller
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef COMPRESSEDMATRIX_HPP
+#define COMPRESSEDMATRIX_HPP
+
+#include <inttypes.h>
+#include <cstdio>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+namespace boost
+{
+  class thread;
+}
+
+// Layout (all in native byte order):
+//   Header, at the start of the file.
+//   uint64_t offsets[mnChunks + 1]; chunk c is stored from offsets[c] up to
+//   offsets[c + 1].
+//   The chunks. Each holds mArraysPerChunk arrays (fewer in the last one),
+//   an array of doubles at a time as in the data file, with the bytes
+//   shuffled so that byte b of every value comes together, and then
+//   compressed with zlib. Shuffling puts the similar sign and exponent
+//   bytes side by side, which compress far better than whole doubles.
+namespace CompressedMatrixFormat
+{
+  static const char kMagic[8] = { 'S', 'V', 'M', 'M', 'A', 'T', 'Z', '\0' };
+  static const uint32_t kVersion = 1;
+
+  struct Header
+  {
+    char mMagic[8];
+    uint32_t mVersion, mnGenes, mnArrays, mArraysPerChunk, mnChunks,
+      mValueSize;
+    uint64_t mReserved[4];
+  };
+}
+
+class CompressedMatrixWriter
+{
+public:
+  CompressedMatrixWriter(const std::string& aFilename, uint32_t anGenes,
+                         uint32_t anArrays);
+  ~CompressedMatrixWriter();
+
+  bool isValid() const { return mFile != NULL; }
+
+  // Arrays must be written in order, all mnArrays of them, and then
+  // finish() called to write out the index.
+  bool writeArray(const double* aRow);
+  bool finish();
+
+private:
+  FILE* mFile;
+  uint32_t mnGenes, mnArrays, mArraysPerChunk, mnBuffered;
+  std::vector<double> mBuffer;
+  std::vector<uint64_t> mOffsets;
+
+  bool writeChunk();
+};
+
+// Reads arrays out of the compressed copy. Recently used chunks are kept
+// decompressed, and prefetch() decompresses a known sequence of arrays on
+// a background thread, a few chunks ahead of where they are being read.
+// readArray() may be called from several threads at once.
+class CompressedMatrix
+{
+public:
+  CompressedMatrix(const std::string& aFilename);
+  ~CompressedMatrix();
+
+  bool isValid() const { return mFD >= 0; }
+  uint32_t getNumGenes() const { return mHeader.mnGenes; }
+  uint32_t getNumArrays() const { return mHeader.mnArrays; }
+
+  void readArray(uint32_t aArray, double* aRow);
+
+  // Starts decompressing the chunks holding aArrays, in that order, ready
+  // for them to be read. Replaces any earlier sequence.
+  void prefetch(const std::vector<uint32_t>& aArrays);
+
+private:
+  typedef boost::shared_ptr<std::vector<double> > Chunk;
+
+  int mFD;
+  CompressedMatrixFormat::Header mHeader;
+  std::vector<uint64_t> mOffsets;
+
+  // Everything below is guarded by mMutex. mCache holds the most recently
+  // used chunks, with mRecent listing them from most to least recent.
+  boost::mutex mMutex;
+  boost::condition_variable mChanged;
+  std::map<uint32_t, Chunk> mCache;
+  std::list<uint32_t> mRecent;
+  // The chunk the background thread is working on, if any, so that readers
+  // wait for it rather than decompressing it again.
+  uint32_t mDecoding;
+  // The chunks prefetch() was asked for, how far the background thread has
+  // got through them, and how far reading has got.
+  std::vector<uint32_t> mSequence;
+  size_t mDecoded, mConsumed;
+  bool mStop;
+  boost::thread* mThread;
+
+  Chunk decode(uint32_t aChunk) const;
+  Chunk getChunk(uint32_t aChunk);
+  void insert(uint32_t aChunk, const Chunk& aData);
+  void stopPrefetching();
+  void prefetchLoop();
+
+  CompressedMatrix(const CompressedMatrix&);
+  CompressedMatrix& operator=(const CompressedMatrix&);
+};
+
+#endif
@@ -0,0 +1,149 @@
+/*
+    Write other encodings of an expression matrix.
+    Copyright (C) 2008-2009  Andrew Miller
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <boost/program_options.hpp>
+#include <boost/filesystem.hpp>
+#include <iostream>
+#include <cstdio>
+#include <vector>
+#include "SVMSupport.hpp"
+
+namespace po = boost::program_options;
+namespace fs = boost::filesystem;
+
+// Writes data32, the single precision copy of the data file which TestSVMs
+// reads with --single-precision. It is laid out the same way, an array at a
+// time, with each double rounded to the nearest float.
+static bool
+writeSinglePrecision(const std::string& aMatrixDir, const std::string& aFile)
+{
+  ExpressionMatrixProcessor emp(aMatrixDir,
+                                ExpressionMatrixProcessor::kMappedSequentialAccess);
+  FILE* out = fopen(aFile.c_str(), "w");
+  if (out == NULL)
+    return false;
+
+  uint32_t nGenes = emp.getNumGenes(), nArrays = emp.getNumArrays();
+  std::vector<float> buffer(nGenes);
+  bool ok = true;
+
+  for (uint32_t a = 0; a < nArrays && ok; a++)
+  {
+    const float* row = emp.readArrayFloat(a, &buffer[0]);
+    ok = (fwrite(row, sizeof(float), nGenes, out) == nGenes);
+  }
+
+  if (fclose(out) != 0)
+    ok = false;
+
+  return ok;
+}
+
+// Writes dataz, the block-compressed copy of the data file. Once it is
+// there, data can be removed, and dataz will be read in its place.
+static bool
+writeCompressed(const std::string& aMatrixDir, const std::string& aFile)
+{
+  ExpressionMatrixProcessor emp(aMatrixDir,
+                                ExpressionMatrixProcessor::kMappedSequentialAccess);
+  uint32_t nGenes = emp.getNumGenes(), nArrays = emp.getNumArrays();
+  CompressedMatrixWriter out(aFile, nGenes, nArrays);
+  std::vector<double> buffer(nGenes);
+  bool ok = out.isValid();
+
+  for (uint32_t a = 0; a < nArrays && ok; a++)
+    ok = out.writeArray(emp.readArray(a, &buffer[0]));
+
+  return out.finish() && ok;
+}
+
+int
+main(int argc, char** argv)
+{
+  po::options_description desc;
+  std::string matrixdir, to;
+
+  desc.add_options()
+    ("matrixdir", po::value<std::string>(&matrixdir),
+     "The directory set up by SOFT2Matrix")
+    ("to", po::value<std::string>(&to),
+     "The encoding to write: float for data32, the single precision copy, "
+     "or compressed for dataz, the block-compressed copy")
+    ;
+
+  po::variables_map vm;
+
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  std::string wrong;
+  if (!vm.count("help"))
+  {
+    if (!vm.count("matrixdir"))
+      wrong = "matrixdir";
+    else if (!vm.count("to"))
+      wrong = "to";
+  }
+
+  if (wrong != "")
+    std::cerr << "Missing option: " << wrong << std::endl;
+  if (vm.count("help") || wrong != "")
+  {
+    std::cout << desc << std::endl;
+    return 1;
+  }
+
+  if (!fs::is_directory(matrixdir))
+  {
+    std::cout << "Matrix directory doesn't exist."
+              << std::endl;
+    return 1;
+  }
+
+  std::string name;
+  if (to == "float")
+    name = "data32";
+  else if (to == "compressed")
+    name = "dataz";
+  else
+  {
+    std::cout << "Unknown encoding " << to << "." << std::endl;
+    return 1;
+  }
+
+  fs::path target(matrixdir), temporary(matrixdir);
+  target /= name;
+  temporary /= name + ".tmp";
+
+  // Don't let a stale or half-written copy get picked up while we work.
+  if (fs::exists(target))
+    fs::remove(target);
+
+  bool ok = (to == "float") ?
+    writeSinglePrecision(matrixdir, temporary.string()) :
+    writeCompressed(matrixdir, temporary.string());
+  if (!ok)
+  {
+    std::cout << "Couldn't write " << temporary.string() << std::endl;
+    fs::remove(temporary);
+    return 1;
+  }
+
+  fs::rename(temporary, target);
+
+  return 0;
+}
@@ -0,0 +1,372 @@
+/*
+    Cross-validate the SVMs for a model over a set of arrays.
+    Copyright (C) 2008-2009  Andrew Miller
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <boost/program_options.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/bind.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/random_number_generator.hpp>
+#include <iostream>
+#include "SVMSupport.hpp"
+#include "SignTest.hpp"
+
+namespace po = boost::program_options;
+namespace fs = boost::filesystem;
+
+// Keeps every error a model gives, in the order testSVMs hands them over,
+// along with which gene each column is.
+class FoldResults
+{
+public:
+  FoldResults()
+    : mFirstRow(true)
+  {
+  }
+
+  void startRow(uint32_t /* aIdx */)
+  {
+  }
+
+  void endRow(uint32_t /* aIdx */)
+  {
+    mFirstRow = false;
+  }
+
+  void result(uint32_t aGene, double aValue)
+  {
+    if (mFirstRow)
+      mGenes.push_back(aGene);
+    mErrors.push_back(aValue);
+  }
+
+  const std::vector<uint32_t>& getGenes() const { return mGenes; }
+  const std::vector<double>& getErrors() const { return mErrors; }
+
+  double
+  getTotalSquaredError() const
+  {
+    double total = 0.0;
+    for (std::vector<double>::const_iterator i = mErrors.begin();
+         i != mErrors.end();
+         i++)
+      if (isfinite(*i))
+        total += *i;
+    return total;
+  }
+
+private:
+  bool mFirstRow;
+  std::vector<uint32_t> mGenes;
+  std::vector<double> mErrors;
+};
+
+// One fold: the model, and optionally the null model, trained on every
+// array outside the fold and tested on those inside it.
+class Fold
+{
+public:
+  Fold(const std::string& aModel, const std::string& aNullModel,
+       ExpressionMatrixProcessor& aEMP, uint32_t aGeneLimit)
+    : mModel(aModel, aEMP, aGeneLimit), mNullModel(NULL),
+      mSquaredError(0.0), mNullSquaredError(0.0)
+  {
+    if (aNullModel != "")
+      mNullModel = new GRNModel(aNullModel, aEMP, aGeneLimit);
+  }
+
+  ~Fold()
+  {
+    if (mNullModel)
+      delete mNullModel;
+  }
+
+  ArraySet mTrainingArrays, mTestingArrays;
+
+  // Reads the training data. This uses the expression matrix's shared
+  // buffers, so only one fold can load at a time.
+  void
+  load(double aGamma, double aC, double aNu)
+  {
+    mModel.setSVMParameters(aGamma, aC, aNu);
+    mModel.loadSVMTrainingData(mTrainingArrays);
+    if (mNullModel)
+    {
+      mNullModel->setSVMParameters(aGamma, aC, aNu);
+      mNullModel->loadSVMTrainingData(mTrainingArrays);
+    }
+  }
+
+  // Trains and tests, with aNumThreads threads for the genes of each model.
+  // Any number of folds can do this at once.
+  void
+  run(uint32_t aNumThreads)
+  {
+    FoldResults model, nullModel;
+    mModel.trainSVMs(aNumThreads);
+    mModel.testSVMs(mTestingArrays, model, aNumThreads);
+    mSquaredError = model.getTotalSquaredError();
+    if (mNullModel == NULL)
+      return;
+
+    mNullModel->trainSVMs(aNumThreads);
+    mNullModel->testSVMs(mTestingArrays, nullModel, aNumThreads);
+    mNullSquaredError = nullModel.getTotalSquaredError();
+    signTest(model, nullModel);
+  }
+
+  double getSquaredError() const { return mSquaredError; }
+  double getNullSquaredError() const { return mNullSquaredError; }
+  const SignTest& getSignTest() const { return mSignTest; }
+
+private:
+  GRNModel mModel, * mNullModel;
+  double mSquaredError, mNullSquaredError;
+  SignTest mSignTest;
+
+  // Compares the errors of the genes which have an SVM in both models,
+  // array by array.
+  void
+  signTest(const FoldResults& aModel, const FoldResults& aNullModel)
+  {
+    const std::vector<uint32_t>& genes(aModel.getGenes()),
+      & nullGenes(aNullModel.getGenes());
+    std::map<uint32_t, uint32_t> nullColumns;
+    for (uint32_t i = 0; i < nullGenes.size(); i++)
+      nullColumns[nullGenes[i]] = i;
+
+    std::vector<uint32_t> columns, matching;
+    for (uint32_t i = 0; i < genes.size(); i++)
+    {
+      std::map<uint32_t, uint32_t>::iterator c = nullColumns.find(genes[i]);
+      if (c == nullColumns.end())
+        continue;
+      columns.push_back(i);
+      matching.push_back(c->second);
+    }
+    if (columns.empty())
+      return;
+
+    const std::vector<double>& errors(aModel.getErrors()),
+      & nullErrors(aNullModel.getErrors());
+    size_t nArrays = errors.size() / genes.size();
+    std::vector<double> row(columns.size()), nullRow(columns.size());
+    for (size_t a = 0; a < nArrays; a++)
+    {
+      for (uint32_t i = 0; i < columns.size(); i++)
+      {
+        row[i] = errors[a * genes.size() + columns[i]];
+        nullRow[i] = nullErrors[a * nullGenes.size() + matching[i]];
+      }
+      mSignTest.add(&nullRow[0], &row[0], columns.size());
+    }
+  }
+};
+
+static void
+run_fold(Fold* aFold, uint32_t aNumThreads)
+{
+  aFold->run(aNumThreads);
+}
+
+// Prints the mean and the (sample) variance of aValues.
+static void
+print_summary(const std::string& aName, const std::vector<double>& aValues)
+{
+  double mean = 0.0, variance = 0.0;
+  for (uint32_t i = 0; i < aValues.size(); i++)
+    mean += aValues[i];
+  mean /= aValues.size();
+  for (uint32_t i = 0; i < aValues.size(); i++)
+    variance += (aValues[i] - mean) * (aValues[i] - mean);
+  if (aValues.size() > 1)
+    variance /= aValues.size() - 1;
+
+  std::cout << aName << ": mean " << mean << ", variance " << variance
+            << std::endl;
+}
+
+int
+main(int argc, char** argv)
+{
+  po::options_description desc;
+  std::string matrixdir, model, nullmodel, arrayset;
+  double loggamma = 0.0, logC = 0.0, nu = 0.5;
+  uint32_t folds = 10, foldThreads = 1, threads = 1, geneLimit = 0,
+    seed = 42;
+
+  desc.add_options()
+    ("matrixdir", po::value<std::string>(&matrixdir),
+     "The directory set up by SOFT2Matrix")
+    ("model", po::value<std::string>(&model),
+     "The gene regulatory network model")
+    ("nullmodel", po::value<std::string>(&nullmodel),
+     "The gene regulatory network null (scrambled) model, to sign test "
+     "each fold against (optional)")
+    ("arrayset", po::value<std::string>(&arrayset),
+     "The list of arrays to split into folds")
+    ("folds", po::value<uint32_t>(&folds),
+     "The number of folds (default 10)")
+    ("seed", po::value<uint32_t>(&seed),
+     "The seed for dealing the arrays out into folds (default 42)")
+    ("gamma", po::value<double>(&loggamma),
+     "The value of the RBF parameter gamma, as a base-e logarithm of the value")
+    ("C", po::value<double>(&logC),
+     "The value of the SVM parameter C, as a base-e logarithm of the value")
+    ("nu", po::value<double>(&nu),
+     "The value of the SVM parameter nu")
+    ("genelimit", po::value<uint32_t>(&geneLimit),
+     "Only use the first this many SVMs of each model (default all)")
+    ("fold-threads", po::value<uint32_t>(&foldThreads),
+     "The number of folds to train and test at once (default 1)")
+    ("threads", po::value<uint32_t>(&threads),
+     "The number of SVMs each fold trains, or arrays it tests, at once "
+     "(default 1)")
+    ("no-mmap", "Read each array from the data file instead of mapping it")
+    ;
+
+  po::variables_map vm;
+
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  std::string wrong;
+  if (!vm.count("help"))
+  {
+    if (!vm.count("matrixdir"))
+      wrong = "matrixdir";
+    else if (!vm.count("model"))
+      wrong = "model";
+    else if (!vm.count("arrayset"))
+      wrong = "arrayset";
+  }
+
+  if (wrong != "")
+    std::cerr << "Missing option: " << wrong << std::endl;
+  if (vm.count("help") || wrong != "")
+  {
+    std::cout << desc << std::endl;
+    return 1;
+  }
+
+  if (!fs::is_directory(matrixdir))
+  {
+    std::cout << "Matrix directory doesn't exist."
+              << std::endl;
+    return 1;
+  }
+
+  if (!fs::is_regular(model))
+  {
+    std::cout << "Model file doesn't exist or not regular file."
+              << std::endl;
+    return 1;
+  }
+
+  if (vm.count("nullmodel") && !fs::is_regular(nullmodel))
+  {
+    std::cout << "Null model file doesn't exist or not regular file."
+              << std::endl;
+    return 1;
+  }
+
+  if (!fs::is_regular(arrayset))
+  {
+    std::cout << "Array set file doesn't exist or not regular file."
+              << std::endl;
+    return 1;
+  }
+
+  ExpressionMatrixProcessor emp
+    (matrixdir, vm.count("no-mmap") ? ExpressionMatrixProcessor::kStreamedAccess :
+                ExpressionMatrixProcessor::kMappedRandomAccess);
+
+  ArraySet arrays;
+  if (!arrays.load(emp, arrayset))
+  {
+    std::cout << "Couldn't use the array set " << arrayset << "."
+              << std::endl;
+    return 1;
+  }
+
+  if (folds < 2 || arrays.size() < folds)
+  {
+    std::cout << "There must be at least two folds, and at least one array "
+                 "in each." << std::endl;
+    return 1;
+  }
+
+  std::vector<Fold*> foldModels;
+  for (uint32_t f = 0; f < folds; f++)
+    foldModels.push_back(new Fold(model, nullmodel, emp, geneLimit));
+
+  // Deal the folds out in turn, and then shuffle which array gets which.
+  boost::mt19937 generator(seed);
+  boost::random_number_generator<boost::mt19937, uint32_t> random(generator);
+  std::vector<uint32_t> parts(arrays.size());
+  for (uint32_t i = 0; i < parts.size(); i++)
+    parts[i] = i % folds;
+  for (uint32_t i = parts.size() - 1; i > 0; i--)
+    std::swap(parts[i], parts[random(i + 1)]);
+
+  std::vector<ArraySet> testing(folds);
+  arrays.split(parts, testing);
+  for (uint32_t f = 0; f < folds; f++)
+  {
+    foldModels[f]->mTestingArrays = testing[f];
+    foldModels[f]->mTrainingArrays = arrays.subtract(testing[f]);
+  }
+
+  for (uint32_t f = 0; f < folds; f++)
+    foldModels[f]->load(exp(loggamma), exp(logC), nu);
+
+  ThreadPool pool(foldThreads ? foldThreads : 1);
+  for (uint32_t f = 0; f < folds; f++)
+    pool.add(boost::bind(run_fold, foldModels[f], threads ? threads : 1));
+  pool.run();
+
+  std::vector<double> squaredErrors, log2ps;
+  for (uint32_t f = 0; f < folds; f++)
+  {
+    Fold& fold(*foldModels[f]);
+    std::cout << "Fold " << (f + 1) << ": " << fold.mTrainingArrays.size()
+              << " training arrays, " << fold.mTestingArrays.size()
+              << " testing arrays; total squared error "
+              << fold.getSquaredError();
+    squaredErrors.push_back(fold.getSquaredError());
+
+    if (nullmodel != "")
+    {
+      const SignTest& test(fold.getSignTest());
+      std::cout << " (null model " << fold.getNullSquaredError()
+                << "); of " << test.getTotal() << " trials, the null model "
+                << "had greater error in " << test.getGreater()
+                << "; log_2 p " << test.getLog2P();
+      log2ps.push_back(test.getLog2P());
+    }
+    std::cout << std::endl;
+  }
+
+  print_summary("Total squared error", squaredErrors);
+  if (!log2ps.empty())
+    print_summary("log_2 p", log2ps);
+
+  for (uint32_t f = 0; f < folds; f++)
+    delete foldModels[f];
+
+  return 0;
+}
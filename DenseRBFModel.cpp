@@ -0,0 +1,588 @@
+/*
+    Dense, batched evaluation of RBF support vector regression models
+    Copyright (C) 2008-2009  Andrew Miller
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "DenseRBFModel.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define DENSERBF_X86
+#include <immintrin.h>
+#endif
+
+// Support vectors are padded out to a multiple of the widest vector, and are
+// visited a block at a time so that a block stays in cache across rows.
+static const uint32_t kPadding = 8;
+static const uint32_t kFloatPadding = 16;
+static const uint32_t kBlockSize = 256;
+
+static void
+scalarKernel(const double* aSV, const double* aCoef, uint32_t aStride,
+             uint32_t aDimensions, double aGamma, const double* aRows,
+             uint32_t aCount, double* aOut)
+{
+  for (uint32_t first = 0; first < aStride; first += kBlockSize)
+  {
+    uint32_t last = std::min(first + kBlockSize, aStride);
+
+    for (uint32_t r = 0; r < aCount; r++)
+    {
+      const double* x = aRows + r * aDimensions;
+      double sum = 0.0;
+
+      for (uint32_t i = first; i < last; i++)
+      {
+        double d = 0.0;
+        for (uint32_t k = 0; k < aDimensions; k++)
+        {
+          double t = aSV[k * aStride + i] - x[k];
+          d += t * t;
+        }
+        sum += aCoef[i] * exp(-aGamma * d);
+      }
+
+      aOut[r] += sum;
+    }
+  }
+}
+
+// The float kernels add up each block of support vectors in float, and only
+// the block totals in double.
+static void
+scalarFloatKernel(const float* aSV, const float* aCoef, uint32_t aStride,
+                  uint32_t aDimensions, float aGamma, const float* aRows,
+                  uint32_t aCount, double* aOut)
+{
+  for (uint32_t first = 0; first < aStride; first += kBlockSize)
+  {
+    uint32_t last = std::min(first + kBlockSize, aStride);
+
+    for (uint32_t r = 0; r < aCount; r++)
+    {
+      const float* x = aRows + r * aDimensions;
+      float sum = 0.0f;
+
+      for (uint32_t i = first; i < last; i++)
+      {
+        float d = 0.0f;
+        for (uint32_t k = 0; k < aDimensions; k++)
+        {
+          float t = aSV[k * aStride + i] - x[k];
+          d += t * t;
+        }
+        sum += aCoef[i] * expf(-aGamma * d);
+      }
+
+      aOut[r] += sum;
+    }
+  }
+}
+
+#ifdef DENSERBF_X86
+
+// exp(x) for x <= 0, as 2^n * e^r with |r| <= ln(2) / 2 and e^r from its
+// Taylor series to r^11 (relative error around 1E-15). Arguments below -708
+// are clamped, which only matters for contributions that are already
+// vanishingly small.
+static const double kExpLowest = -708.0;
+static const double kLog2E = 1.4426950408889634;
+static const double kLn2Hi = 6.93145751953125E-1;
+static const double kLn2Lo = 1.42860682030941723212E-6;
+static const double kExpCoefficients[] =
+{
+  1.0 / 39916800.0, 1.0 / 3628800.0, 1.0 / 362880.0, 1.0 / 40320.0,
+  1.0 / 5040.0, 1.0 / 720.0, 1.0 / 120.0, 1.0 / 24.0, 1.0 / 6.0, 0.5,
+  1.0, 1.0
+};
+
+__attribute__((target("avx2,fma")))
+static inline __m256d
+expAVX2(__m256d x)
+{
+  x = _mm256_max_pd(x, _mm256_set1_pd(kExpLowest));
+  __m256d n = _mm256_round_pd(_mm256_mul_pd(x, _mm256_set1_pd(kLog2E)),
+                              _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  __m256d r = _mm256_fnmadd_pd(n, _mm256_set1_pd(kLn2Hi), x);
+  r = _mm256_fnmadd_pd(n, _mm256_set1_pd(kLn2Lo), r);
+
+  __m256d p = _mm256_set1_pd(kExpCoefficients[0]);
+  for (uint32_t i = 1; i < sizeof(kExpCoefficients) / sizeof(double); i++)
+    p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(kExpCoefficients[i]));
+
+  __m256i e = _mm256_cvtepi32_epi64(_mm256_cvtpd_epi32(n));
+  e = _mm256_slli_epi64(_mm256_add_epi64(e, _mm256_set1_epi64x(1023)), 52);
+  return _mm256_mul_pd(p, _mm256_castsi256_pd(e));
+}
+
+__attribute__((target("avx2,fma")))
+static void
+avx2Kernel(const double* aSV, const double* aCoef, uint32_t aStride,
+           uint32_t aDimensions, double aGamma, const double* aRows,
+           uint32_t aCount, double* aOut)
+{
+  __m256d negGamma = _mm256_set1_pd(-aGamma);
+
+  for (uint32_t first = 0; first < aStride; first += kBlockSize)
+  {
+    uint32_t last = std::min(first + kBlockSize, aStride);
+
+    for (uint32_t r = 0; r < aCount; r++)
+    {
+      const double* x = aRows + r * aDimensions;
+      __m256d sum = _mm256_setzero_pd();
+
+      for (uint32_t i = first; i < last; i += 4)
+      {
+        __m256d d = _mm256_setzero_pd();
+        for (uint32_t k = 0; k < aDimensions; k++)
+        {
+          __m256d t = _mm256_sub_pd(_mm256_load_pd(aSV + k * aStride + i),
+                                    _mm256_set1_pd(x[k]));
+          d = _mm256_fmadd_pd(t, t, d);
+        }
+        sum = _mm256_fmadd_pd(_mm256_load_pd(aCoef + i),
+                              expAVX2(_mm256_mul_pd(negGamma, d)), sum);
+      }
+
+      __m128d h = _mm_add_pd(_mm256_castpd256_pd128(sum),
+                             _mm256_extractf128_pd(sum, 1));
+      aOut[r] += _mm_cvtsd_f64(_mm_add_sd(h, _mm_unpackhi_pd(h, h)));
+    }
+  }
+}
+
+__attribute__((target("avx512f")))
+static inline __m512d
+expAVX512(__m512d x)
+{
+  x = _mm512_max_pd(x, _mm512_set1_pd(kExpLowest));
+  __m512d n = _mm512_roundscale_pd(_mm512_mul_pd(x, _mm512_set1_pd(kLog2E)),
+                                   _MM_FROUND_TO_NEAREST_INT |
+                                   _MM_FROUND_NO_EXC);
+  __m512d r = _mm512_fnmadd_pd(n, _mm512_set1_pd(kLn2Hi), x);
+  r = _mm512_fnmadd_pd(n, _mm512_set1_pd(kLn2Lo), r);
+
+  __m512d p = _mm512_set1_pd(kExpCoefficients[0]);
+  for (uint32_t i = 1; i < sizeof(kExpCoefficients) / sizeof(double); i++)
+    p = _mm512_fmadd_pd(p, r, _mm512_set1_pd(kExpCoefficients[i]));
+
+  return _mm512_scalef_pd(p, n);
+}
+
+__attribute__((target("avx512f")))
+static void
+avx512Kernel(const double* aSV, const double* aCoef, uint32_t aStride,
+             uint32_t aDimensions, double aGamma, const double* aRows,
+             uint32_t aCount, double* aOut)
+{
+  __m512d negGamma = _mm512_set1_pd(-aGamma);
+
+  for (uint32_t first = 0; first < aStride; first += kBlockSize)
+  {
+    uint32_t last = std::min(first + kBlockSize, aStride);
+
+    for (uint32_t r = 0; r < aCount; r++)
+    {
+      const double* x = aRows + r * aDimensions;
+      __m512d sum = _mm512_setzero_pd();
+
+      for (uint32_t i = first; i < last; i += 8)
+      {
+        __m512d d = _mm512_setzero_pd();
+        for (uint32_t k = 0; k < aDimensions; k++)
+        {
+          __m512d t = _mm512_sub_pd(_mm512_load_pd(aSV + k * aStride + i),
+                                    _mm512_set1_pd(x[k]));
+          d = _mm512_fmadd_pd(t, t, d);
+        }
+        sum = _mm512_fmadd_pd(_mm512_load_pd(aCoef + i),
+                              expAVX512(_mm512_mul_pd(negGamma, d)), sum);
+      }
+
+      aOut[r] += _mm512_reduce_add_pd(sum);
+    }
+  }
+}
+
+// The same in single precision: the Taylor series only needs to go to r^7
+// for float accuracy, and arguments are clamped at -87.
+static const float kExpLowestF = -87.0f;
+static const float kLog2EF = 1.44269504f;
+static const float kLn2HiF = 0.693359375f;
+static const float kLn2LoF = -2.12194440E-4f;
+static const float kExpCoefficientsF[] =
+{
+  1.0f / 5040.0f, 1.0f / 720.0f, 1.0f / 120.0f, 1.0f / 24.0f, 1.0f / 6.0f,
+  0.5f, 1.0f, 1.0f
+};
+
+__attribute__((target("avx2,fma")))
+static inline __m256
+expAVX2Float(__m256 x)
+{
+  x = _mm256_max_ps(x, _mm256_set1_ps(kExpLowestF));
+  __m256 n = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(kLog2EF)),
+                             _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  __m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(kLn2HiF), x);
+  r = _mm256_fnmadd_ps(n, _mm256_set1_ps(kLn2LoF), r);
+
+  __m256 p = _mm256_set1_ps(kExpCoefficientsF[0]);
+  for (uint32_t i = 1; i < sizeof(kExpCoefficientsF) / sizeof(float); i++)
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(kExpCoefficientsF[i]));
+
+  __m256i e = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n),
+                                                 _mm256_set1_epi32(127)), 23);
+  return _mm256_mul_ps(p, _mm256_castsi256_ps(e));
+}
+
+__attribute__((target("avx2,fma")))
+static void
+avx2FloatKernel(const float* aSV, const float* aCoef, uint32_t aStride,
+                uint32_t aDimensions, float aGamma, const float* aRows,
+                uint32_t aCount, double* aOut)
+{
+  __m256 negGamma = _mm256_set1_ps(-aGamma);
+
+  for (uint32_t first = 0; first < aStride; first += kBlockSize)
+  {
+    uint32_t last = std::min(first + kBlockSize, aStride);
+
+    for (uint32_t r = 0; r < aCount; r++)
+    {
+      const float* x = aRows + r * aDimensions;
+      __m256 sum = _mm256_setzero_ps();
+
+      for (uint32_t i = first; i < last; i += 8)
+      {
+        __m256 d = _mm256_setzero_ps();
+        for (uint32_t k = 0; k < aDimensions; k++)
+        {
+          __m256 t = _mm256_sub_ps(_mm256_load_ps(aSV + k * aStride + i),
+                                   _mm256_set1_ps(x[k]));
+          d = _mm256_fmadd_ps(t, t, d);
+        }
+        sum = _mm256_fmadd_ps(_mm256_load_ps(aCoef + i),
+                              expAVX2Float(_mm256_mul_ps(negGamma, d)), sum);
+      }
+
+      __m256d wide = _mm256_add_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(sum)),
+                                   _mm256_cvtps_pd(_mm256_extractf128_ps(sum,
+                                                                         1)));
+      __m128d h = _mm_add_pd(_mm256_castpd256_pd128(wide),
+                             _mm256_extractf128_pd(wide, 1));
+      aOut[r] += _mm_cvtsd_f64(_mm_add_sd(h, _mm_unpackhi_pd(h, h)));
+    }
+  }
+}
+
+__attribute__((target("avx512f")))
+static inline __m512
+expAVX512Float(__m512 x)
+{
+  x = _mm512_max_ps(x, _mm512_set1_ps(kExpLowestF));
+  __m512 n = _mm512_roundscale_ps(_mm512_mul_ps(x, _mm512_set1_ps(kLog2EF)),
+                                  _MM_FROUND_TO_NEAREST_INT |
+                                  _MM_FROUND_NO_EXC);
+  __m512 r = _mm512_fnmadd_ps(n, _mm512_set1_ps(kLn2HiF), x);
+  r = _mm512_fnmadd_ps(n, _mm512_set1_ps(kLn2LoF), r);
+
+  __m512 p = _mm512_set1_ps(kExpCoefficientsF[0]);
+  for (uint32_t i = 1; i < sizeof(kExpCoefficientsF) / sizeof(float); i++)
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(kExpCoefficientsF[i]));
+
+  return _mm512_scalef_ps(p, n);
+}
+
+__attribute__((target("avx512f")))
+static void
+avx512FloatKernel(const float* aSV, const float* aCoef, uint32_t aStride,
+                  uint32_t aDimensions, float aGamma, const float* aRows,
+                  uint32_t aCount, double* aOut)
+{
+  __m512 negGamma = _mm512_set1_ps(-aGamma);
+
+  for (uint32_t first = 0; first < aStride; first += kBlockSize)
+  {
+    uint32_t last = std::min(first + kBlockSize, aStride);
+
+    for (uint32_t r = 0; r < aCount; r++)
+    {
+      const float* x = aRows + r * aDimensions;
+      __m512 sum = _mm512_setzero_ps();
+
+      for (uint32_t i = first; i < last; i += 16)
+      {
+        __m512 d = _mm512_setzero_ps();
+        for (uint32_t k = 0; k < aDimensions; k++)
+        {
+          __m512 t = _mm512_sub_ps(_mm512_load_ps(aSV + k * aStride + i),
+                                   _mm512_set1_ps(x[k]));
+          d = _mm512_fmadd_ps(t, t, d);
+        }
+        sum = _mm512_fmadd_ps(_mm512_load_ps(aCoef + i),
+                              expAVX512Float(_mm512_mul_ps(negGamma, d)),
+                              sum);
+      }
+
+      __m512d wide =
+        _mm512_add_pd(_mm512_cvtps_pd(_mm512_castps512_ps256(sum)),
+                      _mm512_cvtps_pd(_mm256_castpd_ps(
+                        _mm512_extractf64x4_pd(_mm512_castps_pd(sum), 1))));
+      aOut[r] += _mm512_reduce_add_pd(wide);
+    }
+  }
+}
+
+#endif
+
+static DenseRBFModel::Kernel
+bestKernel()
+{
+#ifdef DENSERBF_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f"))
+    return avx512Kernel;
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    return avx2Kernel;
+#endif
+  return scalarKernel;
+}
+
+static DenseRBFModel::FloatKernel
+bestFloatKernel()
+{
+#ifdef DENSERBF_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f"))
+    return avx512FloatKernel;
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    return avx2FloatKernel;
+#endif
+  return scalarFloatKernel;
+}
+
+DenseRBFModel::Kernel DenseRBFModel::sKernel = bestKernel();
+DenseRBFModel::FloatKernel DenseRBFModel::sFloatKernel = bestFloatKernel();
+
+bool
+DenseRBFModel::selectKernel(const std::string& aName)
+{
+  if (aName == "auto")
+  {
+    sKernel = bestKernel();
+    sFloatKernel = bestFloatKernel();
+  }
+  else if (aName == "scalar")
+  {
+    sKernel = scalarKernel;
+    sFloatKernel = scalarFloatKernel;
+  }
+#ifdef DENSERBF_X86
+  else if (aName == "avx2" && __builtin_cpu_supports("avx2") &&
+           __builtin_cpu_supports("fma"))
+  {
+    sKernel = avx2Kernel;
+    sFloatKernel = avx2FloatKernel;
+  }
+  else if (aName == "avx512" && __builtin_cpu_supports("avx512f"))
+  {
+    sKernel = avx512Kernel;
+    sFloatKernel = avx512FloatKernel;
+  }
+#endif
+  else
+    return false;
+
+  return true;
+}
+
+DenseRBFModel::DenseRBFModel()
+  : mDimensions(0), mnSV(0), mStride(0), mSV(NULL), mCoef(NULL),
+    mGamma(0.0), mRho(0.0), mOwned(false), mSVf(NULL), mCoefF(NULL),
+    mStrideF(0)
+{
+}
+
+DenseRBFModel::~DenseRBFModel()
+{
+  release();
+}
+
+void
+DenseRBFModel::release()
+{
+  if (mOwned)
+  {
+    free(const_cast<double*>(mSV));
+    free(const_cast<double*>(mCoef));
+  }
+  mSV = mCoef = NULL;
+  mOwned = false;
+
+  free(mSVf);
+  free(mCoefF);
+  mSVf = mCoefF = NULL;
+  mStrideF = 0;
+}
+
+uint32_t
+DenseRBFModel::getStride(uint32_t anSV)
+{
+  return (anSV + kPadding - 1) / kPadding * kPadding;
+}
+
+void
+DenseRBFModel::build(const struct svm_model* aModel, uint32_t aDimensions)
+{
+  release();
+
+  mDimensions = aDimensions;
+  mnSV = aModel->l;
+  mStride = getStride(mnSV);
+  mGamma = aModel->param.gamma;
+  mRho = aModel->rho[0];
+
+  void* p;
+  posix_memalign(&p, 64, sizeof(double) * mStride * (mDimensions ? mDimensions : 1));
+  double* sv = static_cast<double*>(p);
+  posix_memalign(&p, 64, sizeof(double) * (mStride ? mStride : 1));
+  double* coef = static_cast<double*>(p);
+
+  // libsvm leaves out features which are zero, so start from all zeros.
+  memset(sv, 0, sizeof(double) * mStride * mDimensions);
+  memset(coef, 0, sizeof(double) * mStride);
+
+  for (uint32_t i = 0; i < mnSV; i++)
+  {
+    coef[i] = aModel->sv_coef[0][i];
+    for (const svm_node* n = aModel->SV[i]; n->index != -1; n++)
+      if (n->index >= 1 && static_cast<uint32_t>(n->index) <= mDimensions)
+        sv[(n->index - 1) * mStride + i] = n->value;
+  }
+
+  mSV = sv;
+  mCoef = coef;
+  mOwned = true;
+}
+
+void
+DenseRBFModel::attach(uint32_t aDimensions, uint32_t anSV, double aGamma,
+                      double aRho, const double* aCoef, const double* aSV)
+{
+  release();
+
+  mDimensions = aDimensions;
+  mnSV = anSV;
+  mStride = getStride(anSV);
+  mGamma = aGamma;
+  mRho = aRho;
+  mCoef = aCoef;
+  mSV = aSV;
+}
+
+bool
+DenseRBFModel::saveAsLibSVM(const std::string& aFilename) const
+{
+  std::vector<svm_node> nodes(mnSV * (mDimensions + 1));
+  std::vector<svm_node*> svs(mnSV);
+  std::vector<double> coef(mCoef, mCoef + mnSV);
+  double rho = mRho;
+  double* coefp = coef.empty() ? NULL : &coef[0];
+
+  for (uint32_t i = 0; i < mnSV; i++)
+  {
+    svm_node* n = &nodes[i * (mDimensions + 1)];
+    svs[i] = n;
+    for (uint32_t k = 0; k < mDimensions; k++, n++)
+    {
+      n->index = k + 1;
+      n->value = mSV[k * mStride + i];
+    }
+    n->index = -1;
+  }
+
+  struct svm_model m;
+  memset(&m, 0, sizeof(m));
+  m.param.svm_type = NU_SVR;
+  m.param.kernel_type = RBF;
+  m.param.gamma = mGamma;
+  m.nr_class = 2;
+  m.l = mnSV;
+  m.SV = svs.empty() ? NULL : &svs[0];
+  m.sv_coef = &coefp;
+  m.rho = &rho;
+
+  return svm_save_model(aFilename.c_str(), &m) == 0;
+}
+
+void
+DenseRBFModel::prepareSinglePrecision()
+{
+  if (mSVf != NULL)
+    return;
+
+  mStrideF = (mnSV + kFloatPadding - 1) / kFloatPadding * kFloatPadding;
+
+  void* p;
+  posix_memalign(&p, 64, sizeof(float) * mStrideF * (mDimensions ? mDimensions : 1));
+  mSVf = static_cast<float*>(p);
+  posix_memalign(&p, 64, sizeof(float) * (mStrideF ? mStrideF : 1));
+  mCoefF = static_cast<float*>(p);
+
+  memset(mSVf, 0, sizeof(float) * mStrideF * mDimensions);
+  memset(mCoefF, 0, sizeof(float) * mStrideF);
+
+  for (uint32_t i = 0; i < mnSV; i++)
+  {
+    mCoefF[i] = mCoef[i];
+    for (uint32_t k = 0; k < mDimensions; k++)
+      mSVf[k * mStrideF + i] = mSV[k * mStride + i];
+  }
+}
+
+void
+DenseRBFModel::predict(const float* aRows, uint32_t aCount,
+                       double* aOut) const
+{
+  for (uint32_t r = 0; r < aCount; r++)
+    aOut[r] = 0.0;
+
+  if (mStrideF != 0)
+    sFloatKernel(mSVf, mCoefF, mStrideF, mDimensions, mGamma, aRows, aCount,
+                 aOut);
+
+  for (uint32_t r = 0; r < aCount; r++)
+    aOut[r] -= mRho;
+}
+
+void
+DenseRBFModel::predict(const double* aRows, uint32_t aCount,
+                       double* aOut) const
+{
+  for (uint32_t r = 0; r < aCount; r++)
+    aOut[r] = 0.0;
+
+  if (mStride != 0)
+    sKernel(mSV, mCoef, mStride, mDimensions, mGamma, aRows, aCount, aOut);
+
+  for (uint32_t r = 0; r < aCount; r++)
+    aOut[r] -= mRho;
+}
@@ -0,0 +1,105 @@
+/*
+    Dense, batched evaluation of RBF support vector regression models
+    Copyright (C) 2008-2009  Andrew Miller
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DENSERBFMODEL_HPP
+#define DENSERBFMODEL_HPP
+
+#include <inttypes.h>
+#include <string>
+#include <svm.h>
+
+// A copy of a libsvm RBF regression model with the support vectors stored
+// densely, one feature at a time across all of the support vectors, so that
+// the kernel can be evaluated several support vectors per instruction.
+class DenseRBFModel
+{
+public:
+  DenseRBFModel();
+  ~DenseRBFModel();
+
+  // Copies aModel, which must be an RBF regression model whose features are
+  // numbered 1 to aDimensions.
+  void build(const struct svm_model* aModel, uint32_t aDimensions);
+
+  // Uses a model already laid out densely somewhere else (e.g. in a mapped
+  // SVMArchive), without copying it. aCoef and aSV must be 64 byte aligned,
+  // padded out to getStride(anSV), and outlive this object.
+  void attach(uint32_t aDimensions, uint32_t anSV, double aGamma, double aRho,
+              const double* aCoef, const double* aSV);
+
+  // Writes the model out in libsvm's text format.
+  bool saveAsLibSVM(const std::string& aFilename) const;
+
+  // Predicts aCount rows, stored one after the other in aRows, each
+  // getDimensions() long.
+  void predict(const double* aRows, uint32_t aCount, double* aOut) const;
+
+  // Makes a single precision copy of the model, which the float version of
+  // predict() uses. It works out the kernel in floats, twice as many support
+  // vectors per instruction, and only adds up the result in double.
+  void prepareSinglePrecision();
+  bool hasSinglePrecision() const { return mSVf != NULL; }
+  void predict(const float* aRows, uint32_t aCount, double* aOut) const;
+
+  uint32_t getDimensions() const { return mDimensions; }
+  uint32_t getNumSupportVectors() const { return mnSV; }
+  uint32_t getStride() const { return mStride; }
+  double getGamma() const { return mGamma; }
+  double getRho() const { return mRho; }
+  const double* getCoefficients() const { return mCoef; }
+  const double* getSupportVectors() const { return mSV; }
+
+  static uint32_t getStride(uint32_t anSV);
+
+  // Picks the kernel implementation used by every model: "auto" for the
+  // widest the CPU supports, or "scalar", "avx2" or "avx512". Returns false
+  // if the CPU can't run the one asked for.
+  static bool selectKernel(const std::string& aName);
+
+  typedef void (*Kernel)(const double* aSV, const double* aCoef,
+                         uint32_t aStride, uint32_t aDimensions,
+                         double aGamma, const double* aRows,
+                         uint32_t aCount, double* aOut);
+  typedef void (*FloatKernel)(const float* aSV, const float* aCoef,
+                              uint32_t aStride, uint32_t aDimensions,
+                              float aGamma, const float* aRows,
+                              uint32_t aCount, double* aOut);
+
+private:
+  uint32_t mDimensions, mnSV, mStride;
+  // mSV holds feature k of support vector i at [k * mStride + i]. mStride is
+  // mnSV rounded up to a whole number of vectors; the padding has a zero
+  // coefficient.
+  const double* mSV, * mCoef;
+  double mGamma, mRho;
+  bool mOwned;
+  // The single precision copy, laid out the same way but with its own
+  // stride, mnSV rounded up to a whole number of float vectors.
+  float* mSVf, * mCoefF;
+  uint32_t mStrideF;
+
+  void release();
+
+  static Kernel sKernel;
+  static FloatKernel sFloatKernel;
+
+  DenseRBFModel(const DenseRBFModel&);
+  DenseRBFModel& operator=(const DenseRBFModel&);
+};
+
+#endif
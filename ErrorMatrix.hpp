@@ -0,0 +1,257 @@
+/*
+    Reading and writing the per-gene, per-array error matrices.
+    Copyright (C) 2008-2009  Andrew Miller
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ERRORMATRIX_HPP
+#define ERRORMATRIX_HPP
+
+#include <inttypes.h>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+
+// An error matrix is either the original dense format, a row of nGenes
+// doubles per array with NaN for every gene without an SVM, or the sparse
+// format, which starts with a Header and then the indices of the genes
+// which were modelled, and holds just those genes' errors in each row, as
+// floats or doubles.
+namespace ErrorMatrixFormat
+{
+  static const char kMagic[8] = { 'S', 'V', 'M', 'E', 'R', 'R', 'S', '\0' };
+  static const uint32_t kVersion = 1;
+
+  struct Header
+  {
+    char mMagic[8];
+    uint32_t mVersion, mnGenes, mnModelled, mValueSize;
+  };
+}
+
+class ErrorMatrixWriter
+{
+public:
+  enum Format
+  {
+    kDense,
+    kSparseDouble,
+    kSparseFloat
+  };
+
+  // aModelled is only used by the sparse formats, and must be in increasing
+  // order.
+  ErrorMatrixWriter(const std::string& aFile, uint32_t anGenes,
+                    const std::vector<uint32_t>& aModelled, Format aFormat)
+    : mnGenes(anGenes), mModelled(aModelled), mFormat(aFormat)
+  {
+    mOutput = fopen(aFile.c_str(), "w");
+    if (mOutput == NULL || mFormat == kDense)
+      return;
+
+    ErrorMatrixFormat::Header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.mMagic, ErrorMatrixFormat::kMagic, sizeof(h.mMagic));
+    h.mVersion = ErrorMatrixFormat::kVersion;
+    h.mnGenes = mnGenes;
+    h.mnModelled = mModelled.size();
+    h.mValueSize = (mFormat == kSparseFloat) ? sizeof(float) : sizeof(double);
+    fwrite(&h, sizeof(h), 1, mOutput);
+    if (!mModelled.empty())
+      fwrite(&mModelled[0], sizeof(uint32_t), mModelled.size(), mOutput);
+  }
+
+  ~ErrorMatrixWriter()
+  {
+    if (mOutput)
+      fclose(mOutput);
+  }
+
+  bool isValid() const { return mOutput != NULL; }
+
+  // aRow holds an error for every gene.
+  void
+  writeRow(const double* aRow)
+  {
+    if (mOutput == NULL)
+      return;
+
+    if (mFormat == kDense)
+    {
+      fwrite(aRow, mnGenes * sizeof(double), 1, mOutput);
+      return;
+    }
+
+    uint32_t n = mModelled.size();
+    if (mFormat == kSparseFloat)
+    {
+      mFloats.resize(n);
+      for (uint32_t i = 0; i < n; i++)
+        mFloats[i] = aRow[mModelled[i]];
+      if (n > 0)
+        fwrite(&mFloats[0], sizeof(float), n, mOutput);
+    }
+    else
+    {
+      mDoubles.resize(n);
+      for (uint32_t i = 0; i < n; i++)
+        mDoubles[i] = aRow[mModelled[i]];
+      if (n > 0)
+        fwrite(&mDoubles[0], sizeof(double), n, mOutput);
+    }
+  }
+
+  static bool
+  parseFormat(const std::string& aName, Format& aFormat)
+  {
+    if (aName == "dense")
+      aFormat = kDense;
+    else if (aName == "sparse")
+      aFormat = kSparseDouble;
+    else if (aName == "sparse-float")
+      aFormat = kSparseFloat;
+    else
+      return false;
+    return true;
+  }
+
+private:
+  FILE* mOutput;
+  uint32_t mnGenes;
+  std::vector<uint32_t> mModelled;
+  Format mFormat;
+  std::vector<float> mFloats;
+  std::vector<double> mDoubles;
+};
+
+// Reads either format. Dense files don't say how many genes they have, so
+// that has to be given (anGenes) to read them a row at a time.
+class ErrorMatrixReader
+{
+public:
+  ErrorMatrixReader(const std::string& aFile, uint32_t anGenes = 0)
+    : mnGenes(anGenes), mValueSize(sizeof(double)), mSparse(false)
+  {
+    mInput = fopen(aFile.c_str(), "r");
+    if (mInput == NULL)
+      return;
+
+    ErrorMatrixFormat::Header h;
+    if (fread(&h, sizeof(h), 1, mInput) == 1 &&
+        memcmp(h.mMagic, ErrorMatrixFormat::kMagic, sizeof(h.mMagic)) == 0)
+    {
+      if (h.mVersion != ErrorMatrixFormat::kVersion ||
+          (h.mValueSize != sizeof(float) && h.mValueSize != sizeof(double)))
+      {
+        fclose(mInput);
+        mInput = NULL;
+        return;
+      }
+
+      mSparse = true;
+      mnGenes = h.mnGenes;
+      mValueSize = h.mValueSize;
+      mModelled.resize(h.mnModelled);
+      if (h.mnModelled > 0 &&
+          fread(&mModelled[0], sizeof(uint32_t), h.mnModelled, mInput) !=
+          h.mnModelled)
+      {
+        fclose(mInput);
+        mInput = NULL;
+      }
+      return;
+    }
+
+    rewind(mInput);
+    setNumGenes(mnGenes);
+  }
+
+  // For dense files, which don't record it.
+  void
+  setNumGenes(uint32_t anGenes)
+  {
+    if (mSparse)
+      return;
+
+    mnGenes = anGenes;
+    mModelled.clear();
+    for (uint32_t i = 0; i < mnGenes; i++)
+      mModelled.push_back(i);
+  }
+
+  ~ErrorMatrixReader()
+  {
+    if (mInput)
+      fclose(mInput);
+  }
+
+  bool isValid() const { return mInput != NULL; }
+  bool isSparse() const { return mSparse; }
+  uint32_t getNumGenes() const { return mnGenes; }
+  // The genes each row holds a value for; every gene in a dense file.
+  const std::vector<uint32_t>& getModelledGenes() const { return mModelled; }
+  FILE* getFile() { return mInput; }
+
+  // Reads the next row's values for getModelledGenes(). A file without any
+  // modelled genes has no rows.
+  bool
+  readRow(double* aValues)
+  {
+    uint32_t n = mModelled.size();
+    if (mInput == NULL || n == 0)
+      return false;
+
+    if (mValueSize == sizeof(double))
+      return fread(aValues, sizeof(double), n, mInput) == n;
+
+    mFloats.resize(n);
+    if (fread(&mFloats[0], sizeof(float), n, mInput) != n)
+      return false;
+    for (uint32_t i = 0; i < n; i++)
+      aValues[i] = mFloats[i];
+    return true;
+  }
+
+  // Reads the next row out to every gene, with NaN for those not modelled.
+  bool
+  readFullRow(double* aRow)
+  {
+    if (!mSparse)
+      return readRow(aRow);
+
+    mValues.resize(mModelled.size());
+    if (mModelled.empty() || !readRow(&mValues[0]))
+      return false;
+
+    for (uint32_t i = 0; i < mnGenes; i++)
+      aRow[i] = std::numeric_limits<double>::quiet_NaN();
+    for (uint32_t i = 0; i < mModelled.size(); i++)
+      if (mModelled[i] < mnGenes)
+        aRow[mModelled[i]] = mValues[i];
+    return true;
+  }
+
+private:
+  FILE* mInput;
+  uint32_t mnGenes, mValueSize;
+  bool mSparse;
+  std::vector<uint32_t> mModelled;
+  std::vector<float> mFloats;
+  std::vector<double> mValues;
+};
+
+#endif
@@ -19,8 +19,13 @@
 #include <boost/filesystem.hpp>
 #include <boost/program_options.hpp>
 #include <boost/regex.hpp>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
 #include <iostream>
+#include <sstream>
+#include <cstdio>
 #include "SVMSupport.hpp"
+#include "SignTest.hpp"
 #include <ga/make_ga.h>
 #include <eo>
 #include <es.h>
@@ -41,10 +46,12 @@ class ResultListener
 {
 public:
   ResultListener(uint32_t anArrays, uint32_t anGenes)
-    : mnArrays(anArrays), mnGenes(anGenes), mData(NULL)
+    : mnArrays(anArrays), mnGenes(anGenes), mData(NULL),
+      mModelHalf(NULL), mNullModelHalf(NULL)
   {
     mData = new double[mnArrays * mnGenes * 2];
-    p = mData;
+    mModelHalf.p = mData;
+    mNullModelHalf.p = mData + mnGenes * mnArrays;
   }
 
   ~ResultListener()
@@ -53,201 +60,911 @@ public:
       delete [] mData;
   }
 
-  void startRow(uint32_t aIdx)
+  // Collects the results from one of the two models. The model and the null
+  // model each have their own half of the buffer, so they can be tested at
+  // the same time.
+  class Half
   {
+  public:
+    Half(double* aStart)
+      : p(aStart)
+    {
+    }
+
+    void startRow(uint32_t aIdx)
+    {
+    }
+
+    void endRow(uint32_t aIdx)
+    {
+    }
+
+    void result(uint32_t gene, double val)
+    {
+      *p++ = val;
+    }
+
+  private:
+    friend class ResultListener;
+    double* p;
+  };
+
+  Half& getModelHalf() { return mModelHalf; }
+  Half& getNullModelHalf() { return mNullModelHalf; }
+
+  double log2pval()
+  {
+    double * end = mData + mnGenes * mnArrays;
+
+    if (mModelHalf.p != end || mNullModelHalf.p != end + mnGenes * mnArrays)
+    {
+      printf("log2pval called when there were %ld results, instead of %u, so will yield wrong results.\n",
+             (mModelHalf.p - mData) + (mNullModelHalf.p - end),
+             mnGenes * mnArrays * 2);
+      assert(0);
+    }
+
+    SignTest test;
+    test.add(mData, end, mnGenes * mnArrays);
+    printf("x = %u, n = %u\n", test.getGreater(), test.getTotal());
+
+    return test.getLog2P();
   }
 
-  void endRow(uint32_t aIdx)
+private:
+  uint32_t mnArrays, mnGenes;
+  double * mData;
+  Half mModelHalf, mNullModelHalf;
+};
+
+static void
+train_and_test(GRNModel& aModel, const ArraySet& aTestingSet,
+               ResultListener::Half& aResults)
+{
+  aModel.trainSVMs();
+  aModel.testSVMs(aTestingSet, aResults);
+}
+
+static bool
+write_fully(int aFD, const void* aData, size_t aSize)
+{
+  const char* p = static_cast<const char*>(aData);
+  while (aSize > 0)
   {
+    ssize_t n = write(aFD, p, aSize);
+    if (n <= 0)
+      return false;
+    p += n;
+    aSize -= n;
   }
+  return true;
+}
+
+// Runs in the child: trains and tests both models, at the same time, with
+// whatever parameters they were given before the fork, and reports back
+// down aPipe: the log_2 p value, and then the support rows of the model and
+// the null model, for warm starting later evaluations. The two models only
+// share the expression matrix, which nothing writes to any more by this
+// point.
+void
+safe_svm_evaluator(GRNModel& m, GRNModel& nm, const ArraySet& testingSet,
+                   uint32_t numGenes, uint32_t numArrays, int aPipe)
+{
+  ResultListener rl(numGenes, numArrays);
+
+  boost::thread nullModel(boost::bind(train_and_test, boost::ref(nm),
+                                      boost::cref(testingSet),
+                                      boost::ref(rl.getNullModelHalf())));
+  train_and_test(m, testingSet, rl.getModelHalf());
+  nullModel.join();
 
-  void result(uint32_t gene, double val)
+  double result = rl.log2pval();
+  printf("Model and null model training done; log_2 p %g\n", result);
+
+  std::vector<uint32_t> rows;
+  m.getSupportRows(rows);
+  nm.getSupportRows(rows);
+  if (write_fully(aPipe, &result, sizeof(double)) && !rows.empty())
+    write_fully(aPipe, &rows[0], rows.size() * sizeof(uint32_t));
+
+  exit(0);
+}
+
+// Evaluates parameter sets in up to mNumWorkers child processes at once.
+// Each child gets 500 seconds for the model and the null model together
+// before it is killed and scored 0.
+//
+// The support vectors each child ends up with are kept, and a later
+// evaluation with parameters close enough to an earlier one starts training
+// from them. Only evaluations from earlier calls to evaluate() are used, so
+// that the results don't depend on which children finish first.
+class SVMEvaluationPool
+{
+public:
+  SVMEvaluationPool(GRNModel& aM, GRNModel& aNM,
+                    const ArraySet& aTestingSet,
+                    uint32_t aNumGenes, uint32_t aNumArrays,
+                    uint32_t aNumWorkers, bool aWarmStart)
+    : mM(aM), mNM(aNM), mTestingSet(aTestingSet), mNumGenes(aNumGenes),
+      mNumArrays(aNumArrays), mNumWorkers(aNumWorkers ? aNumWorkers : 1),
+      mUseWarmStarts(aWarmStart)
   {
-    *p++ = val;
   }
 
-  double log2pval()
+  // Each entry of aParameters is (gamma, C, nu); the log_2 p value for each
+  // is put in the same place in aResults, whatever order they finish in.
+  // aCompleted says which of them were actually scored, rather than given 0
+  // because their child timed out or failed. If aGenes or aTrainingRows are
+  // given, each is scored more cheaply, on only the first aGenes genes and
+  // trained on only the first aTrainingRows training arrays; support vectors
+  // are only kept for warm starts from full evaluations.
+  void
+  evaluate(const std::vector<std::vector<double> >& aParameters,
+           std::vector<double>& aResults, std::vector<bool>& aCompleted,
+           uint32_t aGenes = 0, uint32_t aTrainingRows = 0)
   {
-    double * p1 = mData, * p2 = mData + mnGenes * mnArrays;
-    double * end = p2;
+    aResults.assign(aParameters.size(), 0.0);
+    aCompleted.assign(aParameters.size(), false);
+    std::vector<WarmStart> warmStarts(aParameters.size());
 
-    int32_t n = 0, x = 0;
+    uint32_t genes = mNumGenes;
+    if (aGenes != 0 && aGenes < mNumGenes)
+      genes = aGenes;
+    mM.setTrainingRowLimit(aTrainingRows);
+    mNM.setTrainingRowLimit(aTrainingRows);
 
-    if (p != mData + mnGenes * mnArrays * 2)
+    std::list<Child> running;
+    uint32_t next = 0;
+
+    while (next < aParameters.size() || !running.empty())
     {
-      printf("log2pval called when there were %ld results, instead of %u, so will yield wrong results.\n",
-             (p - mData), mnGenes * mnArrays * 2);
-      assert(0);
+      while (next < aParameters.size() && running.size() < mNumWorkers)
+      {
+        Child c;
+        if (start(aParameters[next], next, genes, c))
+          running.push_back(c);
+        next++;
+      }
+
+      waitForChildren(running, aResults, aCompleted, warmStarts);
     }
 
-    while (p1 < end)
+    if (!mUseWarmStarts || genes != mNumGenes || aTrainingRows != 0)
+      return;
+
+    for (uint32_t i = 0; i < aParameters.size(); i++)
     {
-      double v1 = *p1++, v2 = *p2++;
+      if (warmStarts[i].mRows.empty())
+        continue;
+      warmStarts[i].mParameters = aParameters[i];
+      mWarmStarts.push_back(warmStarts[i]);
+    }
+    while (mWarmStarts.size() > kMaxWarmStarts)
+      mWarmStarts.pop_front();
+  }
 
-      if (finite(v1) && finite(v2) && v1 != v2)
+private:
+  static const time_t kTimeout = 500;
+  static const size_t kMaxWarmStarts = 64;
+  // How far apart, in (ln gamma, ln C, nu), parameters can be for one to be
+  // warm started from the other.
+  static const double kWarmStartDistance;
+
+  struct Child
+  {
+    uint32_t mIndex;
+    pid_t mPid;
+    int mPipe;
+    time_t mDeadline;
+    std::vector<char> mOutput;
+  };
+
+  struct WarmStart
+  {
+    std::vector<double> mParameters;
+    std::vector<uint32_t> mRows;
+  };
+
+  GRNModel& mM, & mNM;
+  const ArraySet& mTestingSet;
+  uint32_t mNumGenes, mNumArrays, mNumWorkers;
+  bool mUseWarmStarts;
+  std::list<WarmStart> mWarmStarts;
+
+  const WarmStart*
+  findWarmStart(const std::vector<double>& aParameters)
+  {
+    const WarmStart* best = NULL;
+    double bestDistance = kWarmStartDistance;
+    for (std::list<WarmStart>::iterator i = mWarmStarts.begin();
+         i != mWarmStarts.end();
+         i++)
+    {
+      double dg = log(aParameters[0]) - log(i->mParameters[0]),
+        dC = log(aParameters[1]) - log(i->mParameters[1]),
+        dnu = aParameters[2] - i->mParameters[2];
+      double d = sqrt(dg * dg + dC * dC + dnu * dnu);
+      if (d < bestDistance)
       {
-        n++;
-        if (v1 > v2)
-          x++;
+        best = &*i;
+        bestDistance = d;
       }
     }
 
-    printf("x = %u, n = %u\n", x, n);
+    return best;
+  }
 
-    if (x > n - x)
-      x = n - x;
+  bool
+  start(const std::vector<double>& aParameters, uint32_t aIndex,
+        uint32_t aGenes, Child& aChild)
+  {
+    mM.setSVMParameters(aParameters[0], aParameters[1], aParameters[2]);
+    mNM.setSVMParameters(aParameters[0], aParameters[1], aParameters[2]);
 
-    return ((-n) + 1.0 + recurseComputeLogProb(n, 1, x));
-  }
+    // An empty list of rows clears out any warm start from last time.
+    const WarmStart* ws = findWarmStart(aParameters);
+    const uint32_t* rows = NULL, * end = NULL;
+    if (ws != NULL)
+    {
+      rows = &ws->mRows[0];
+      end = rows + ws->mRows.size();
+    }
+    mM.setWarmStart(rows, end);
+    mNM.setWarmStart(rows, end);
 
-private:
-  uint32_t mnArrays, mnGenes;
-  double * mData, * p;
+    int pipes[2];
+    if (pipe(pipes) != 0)
+      return false;
+
+    // Otherwise anything still buffered gets written again by the child.
+    fflush(stdout);
+    std::cout.flush();
 
-  double recurseComputeLogProb(uint32_t n, uint32_t i, uint32_t x)
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+      close(pipes[0]);
+      // The child's copies of the models are thrown away when it exits.
+      if (aGenes < mNumGenes)
+      {
+        mM.truncateSVMs(aGenes);
+        mNM.truncateSVMs(aGenes);
+      }
+      safe_svm_evaluator(mM, mNM, mTestingSet, aGenes, mNumArrays,
+                         pipes[1]);
+    }
+
+    close(pipes[1]);
+    if (pid < 0)
+    {
+      close(pipes[0]);
+      return false;
+    }
+
+    aChild.mIndex = aIndex;
+    aChild.mPid = pid;
+    aChild.mPipe = pipes[0];
+    aChild.mDeadline = time(NULL) + kTimeout;
+
+    return true;
+  }
+
+  void
+  finish(Child& aChild, std::vector<double>& aResults, double aResult)
   {
-    if (i > x)
-      return 0.0;
+    close(aChild.mPipe);
+    int status;
+    waitpid(aChild.mPid, &status, 0);
 
-    return addOneToExponential(log2((n + 1 - i) / (0.0 + i)) +
-                               recurseComputeLogProb(n, i + 1, x));
+    printf("Returning result: %g\n", aResult);
+    aResults[aChild.mIndex] = aResult;
   }
 
-  double addOneToExponential(double v)
+  // Waits until at least one child makes progress or runs out of time. A
+  // child is done once it closes its end of the pipe.
+  void
+  waitForChildren(std::list<Child>& aRunning, std::vector<double>& aResults,
+                  std::vector<bool>& aCompleted,
+                  std::vector<WarmStart>& aWarmStarts)
   {
-    // Approximation: for large v, log_2(2^v + 1) approx v
-    if (v > 30.0)
-      return v;
+    time_t now = time(NULL), first = now + kTimeout;
+    fd_set s;
+    FD_ZERO(&s);
+    int maxfd = -1;
+    for (std::list<Child>::iterator i = aRunning.begin();
+         i != aRunning.end();
+         i++)
+    {
+      FD_SET(i->mPipe, &s);
+      maxfd = std::max(maxfd, i->mPipe);
+      first = std::min(first, i->mDeadline);
+    }
+
+    struct timeval tv;
+    tv.tv_sec = (first > now) ? (first - now) : 0;
+    tv.tv_usec = 0;
+    if (select(maxfd + 1, &s, NULL, NULL, &tv) < 0)
+      FD_ZERO(&s);
+
+    now = time(NULL);
+    std::list<Child>::iterator i = aRunning.begin();
+    while (i != aRunning.end())
+    {
+      if (!FD_ISSET(i->mPipe, &s))
+      {
+        if (i->mDeadline > now)
+        {
+          i++;
+          continue;
+        }
+
+        printf("Timeout on model; killing process.\n");
+        kill(i->mPid, SIGKILL);
+        finish(*i, aResults, 0);
+        i = aRunning.erase(i);
+        continue;
+      }
+
+      char buffer[65536];
+      ssize_t n = read(i->mPipe, buffer, sizeof(buffer));
+      if (n > 0)
+      {
+        i->mOutput.insert(i->mOutput.end(), buffer, buffer + n);
+        i++;
+        continue;
+      }
+
+      if (n < 0 || i->mOutput.size() < sizeof(double))
+      {
+        printf("Read error on model.\n");
+        kill(i->mPid, SIGKILL);
+        finish(*i, aResults, 0);
+        i = aRunning.erase(i);
+        continue;
+      }
+
+      double result;
+      memcpy(&result, &i->mOutput[0], sizeof(double));
+      size_t nRows = (i->mOutput.size() - sizeof(double)) / sizeof(uint32_t);
+      std::vector<uint32_t>& rows(aWarmStarts[i->mIndex].mRows);
+      rows.resize(nRows);
+      if (nRows > 0)
+        memcpy(&rows[0], &i->mOutput[sizeof(double)],
+               nRows * sizeof(uint32_t));
 
-    return log2(1.0 + pow(2.0, v));
+      aCompleted[i->mIndex] = true;
+      finish(*i, aResults, result);
+      i = aRunning.erase(i);
+    }
   }
 };
 
-double
-safe_svm_evaluator(GRNModel& m, GRNModel& nm, const std::list<std::string>& testingSet,
-                   uint32_t numGenes, uint32_t numArrays)
+const double SVMEvaluationPool::kWarmStartDistance = 1.0;
+
+// Keeps the score of every parameter set evaluated in a file, so that the
+// same parameters, or ones too close to make any real difference, are never
+// evaluated twice, in this run or a later one. Each entry also records a
+// fingerprint of the inputs it was scored with, and only entries with the
+// current fingerprint are used. The file is only ever appended to, so a
+// run being killed loses at most the entry being written.
+class FitnessCache
 {
-  int pipes[2];
-  pid_t pid;
+public:
+  // Parameters are (ln gamma, ln C, nu), rounded to multiples of these.
+  static const double kLogQuantum, kNuQuantum;
 
-  pipe(pipes);
-  if ((pid = fork()) == 0)
+  struct Key
   {
-    close(pipes[0]);
+    int32_t mValues[3];
 
-    ResultListener rl(numGenes, numArrays);
+    bool operator<(const Key& aOther) const
+    {
+      return std::lexicographical_compare(mValues, mValues + 3,
+                                          aOther.mValues,
+                                          aOther.mValues + 3);
+    }
+  };
 
-    m.trainSVMs();
+  FitnessCache(const std::string& aFilename, uint64_t aFingerprint)
+    : mFingerprint(aFingerprint)
+  {
+    mFile = fopen(aFilename.c_str(), "a+");
+    if (mFile == NULL)
+    {
+      std::cerr << "Couldn't open the fitness cache " << aFilename
+                << std::endl;
+      return;
+    }
 
-    m.testSVMs(testingSet, rl);
-    printf("Model training done.\n");
-    double x = 0.0;
-    write(pipes[1], &x, sizeof(double));
+    rewind(mFile);
+    Entry e;
+    off_t good = 0;
+    while (fread(&e, sizeof(e), 1, mFile) == 1)
+    {
+      good += sizeof(e);
+      if (e.mFingerprint == mFingerprint)
+        mFitnesses[e.mKey] = e.mFitness;
+    }
 
-    nm.trainSVMs();
+    // Drop any entry left half written, so the next ones line up.
+    if (ftruncate(fileno(mFile), good) != 0)
+      std::cerr << "Couldn't tidy up the fitness cache " << aFilename
+                << std::endl;
+    fseek(mFile, 0, SEEK_END);
+  }
 
-    nm.testSVMs(testingSet, rl);
-    
-    double result = rl.log2pval();
-    printf("Null model training done; log_2 p %g\n", result);
-    write(pipes[1], &result, sizeof(double));
+  ~FitnessCache()
+  {
+    if (mFile != NULL)
+      fclose(mFile);
+  }
 
-    exit(0);
+  static Key
+  makeKey(const std::vector<double>& aParameters)
+  {
+    Key k;
+    k.mValues[0] = lround(aParameters[0] / kLogQuantum);
+    k.mValues[1] = lround(aParameters[1] / kLogQuantum);
+    k.mValues[2] = lround(aParameters[2] / kNuQuantum);
+    return k;
   }
-  else
+
+  bool
+  find(const Key& aKey, double& aFitness) const
   {
-    close(pipes[1]);
+    std::map<Key, double>::const_iterator i = mFitnesses.find(aKey);
+    if (i == mFitnesses.end())
+      return false;
+    aFitness = i->second;
+    return true;
+  }
 
-    struct timeval tv;
-    // Give it 120 seconds (for each result, 4 min total)...
-    tv.tv_sec = 500;
-    tv.tv_usec = 0;
-    fd_set s;
-    FD_ZERO(&s);
-    FD_SET(pipes[0], &s);
-    double result;
-    if (select(pipes[0] + 1, &s, NULL, &s, &tv) <= 0)
+  void
+  add(const Key& aKey, double aFitness)
+  {
+    mFitnesses[aKey] = aFitness;
+    if (mFile == NULL)
+      return;
+
+    Entry e;
+    memset(&e, 0, sizeof(e));
+    e.mFingerprint = mFingerprint;
+    e.mKey = aKey;
+    e.mFitness = aFitness;
+    fwrite(&e, sizeof(e), 1, mFile);
+    fflush(mFile);
+  }
+
+  // Adds aFile's contents to the 64 bit FNV-1a hash aHash.
+  static uint64_t
+  fingerprintFile(const std::string& aFile, uint64_t aHash)
+  {
+    std::ifstream f(aFile.c_str(), std::ios::binary);
+    char buffer[65536];
+    while (f.good())
     {
-      printf("Timeout on model; killing process.\n");
-      kill(pid, SIGKILL);
-      result = 0;
+      f.read(buffer, sizeof(buffer));
+      aHash = fingerprint(buffer, f.gcount(), aHash);
     }
-    else
+    return fingerprint("\0", 1, aHash);
+  }
+
+  static uint64_t
+  fingerprint(const void* aData, size_t aSize,
+              uint64_t aHash = 14695981039346656037ULL)
+  {
+    const unsigned char* p = static_cast<const unsigned char*>(aData);
+    for (size_t i = 0; i < aSize; i++)
     {
-      if (read(pipes[0], &result, sizeof(double) + 1) != sizeof(double))
+      aHash ^= p[i];
+      aHash *= 1099511628211ULL;
+    }
+    return aHash;
+  }
+
+private:
+  struct Entry
+  {
+    uint64_t mFingerprint;
+    Key mKey;
+    uint32_t mReserved;
+    double mFitness;
+  };
+
+  FILE* mFile;
+  uint64_t mFingerprint;
+  std::map<Key, double> mFitnesses;
+};
+
+const double FitnessCache::kLogQuantum = 0.01;
+const double FitnessCache::kNuQuantum = 0.001;
+
+// Evaluates all of the new individuals in a generation together.
+//
+// With more than one rung, the individuals are whittled down by successive
+// halving: all of them are first scored on a small fraction of the genes and
+// training arrays, only the best 1/aRate of those are scored again on aRate
+// times as much, and so on, until the last rung scores whoever is left in
+// full. The rest are given 0, as if they had timed out, so every score the
+// search sees is a full one.
+class EvaluateSVMFit
+  : public eoPopEvalFunc<Indi>
+{
+public:
+  // aCache may be NULL.
+  EvaluateSVMFit(SVMEvaluationPool& aPool, std::list<double>& aLastRun,
+                 FitnessCache* aCache, uint32_t aNumGenes,
+                 uint32_t aNumTrainingRows, uint32_t aRungs = 1,
+                 double aRate = 3.0)
+    : mPool(aPool), mLastRun(aLastRun), mCache(aCache),
+      mNumGenes(aNumGenes), mNumTrainingRows(aNumTrainingRows),
+      mRungs(aRungs ? aRungs : 1), mRate(aRate)
+  {
+  }
+
+  virtual void operator() (eoPop<Indi>& /* aParents */, eoPop<Indi>& aOffspring)
+  {
+    std::vector<uint32_t> toRun;
+    std::vector<std::vector<double> > parameters;
+    std::vector<double> fitnesses(aOffspring.size());
+    std::map<FitnessCache::Key, uint32_t> batch;
+    std::vector<FitnessCache::Key> keys;
+    std::vector<std::pair<uint32_t, uint32_t> > duplicates;
+
+    // Scores replayed from the last run are used up in population order, as
+    // they always have been.
+    for (uint32_t i = 0; i < aOffspring.size(); i++)
+    {
+      Indi& indi(aOffspring[i]);
+      if (!indi.invalid())
+        continue;
+
+      if (!mLastRun.empty())
       {
-        printf("Read error on model.\n");
-        result = 0;
+        fitnesses[i] = mLastRun.front();
+        mLastRun.pop_front();
+        continue;
       }
-      else
+
+      // With a cache, parameters scored before, or already being scored
+      // in this generation, aren't evaluated again.
+      if (mCache != NULL)
+      {
+        FitnessCache::Key k(FitnessCache::makeKey(indi));
+        if (mCache->find(k, fitnesses[i]))
+          continue;
+
+        std::map<FitnessCache::Key, uint32_t>::iterator same =
+          batch.find(k);
+        if (same != batch.end())
+        {
+          duplicates.push_back(std::pair<uint32_t, uint32_t>(i, same->second));
+          continue;
+        }
+        batch[k] = toRun.size();
+        keys.push_back(k);
+      }
+
+      std::vector<double> p(3);
+      p[0] = exp(indi[0]);
+      p[1] = exp(indi[1]);
+      p[2] = indi[2];
+      parameters.push_back(p);
+      toRun.push_back(i);
+    }
+
+    std::vector<double> results;
+    std::vector<bool> completed;
+    std::vector<std::string> notes;
+    evaluate(parameters, results, completed, notes);
+    for (uint32_t i = 0; i < toRun.size(); i++)
+    {
+      fitnesses[toRun[i]] = results[i];
+      if (mCache != NULL && completed[i])
+        mCache->add(keys[i], results[i]);
+    }
+    std::vector<std::string> fitnessNotes(aOffspring.size());
+    for (uint32_t i = 0; i < toRun.size(); i++)
+      fitnessNotes[toRun[i]] = notes[i];
+    for (uint32_t i = 0; i < duplicates.size(); i++)
+    {
+      fitnesses[duplicates[i].first] = results[duplicates[i].second];
+      fitnessNotes[duplicates[i].first] = notes[duplicates[i].second];
+    }
+
+    for (uint32_t i = 0; i < aOffspring.size(); i++)
+    {
+      Indi& indi(aOffspring[i]);
+      if (!indi.invalid())
+        continue;
+
+      indi.fitness(fitnesses[i]);
+      std::cout << "SVM Result: log2 gamma (" << indi[0] << ") "
+                   "log2 C (" << indi[1] << ") nu (" << indi[2]
+                << ") Result (" << fitnesses[i] << ")"
+                << fitnessNotes[i] << std::endl;
+    }
+  }
+
+private:
+  SVMEvaluationPool& mPool;
+  std::list<double>& mLastRun;
+  FitnessCache* mCache;
+  uint32_t mNumGenes, mNumTrainingRows, mRungs;
+  double mRate;
+
+  // Scores aParameters as SVMEvaluationPool::evaluate does, but by
+  // successive halving. aNotes says at which rung any that were dropped
+  // were stopped, and how they scored there; only full scores are marked
+  // as completed.
+  void
+  evaluate(const std::vector<std::vector<double> >& aParameters,
+           std::vector<double>& aResults, std::vector<bool>& aCompleted,
+           std::vector<std::string>& aNotes)
+  {
+    aResults.assign(aParameters.size(), 0.0);
+    aCompleted.assign(aParameters.size(), false);
+    aNotes.assign(aParameters.size(), "");
+
+    std::vector<uint32_t> alive;
+    for (uint32_t i = 0; i < aParameters.size(); i++)
+      alive.push_back(i);
+
+    for (uint32_t rung = 0; rung < mRungs && !alive.empty(); rung++)
+    {
+      std::vector<std::vector<double> > parameters;
+      for (uint32_t i = 0; i < alive.size(); i++)
+        parameters.push_back(aParameters[alive[i]]);
+
+      std::vector<double> results;
+      std::vector<bool> completed;
+      if (rung + 1 == mRungs)
       {
-        tv.tv_sec = 500;
-        tv.tv_usec = 0;
-        FD_SET(pipes[0], &s);
-        if (select(pipes[0] + 1, &s, NULL, &s, &tv) <= 0)
+        mPool.evaluate(parameters, results, completed);
+        for (uint32_t i = 0; i < alive.size(); i++)
         {
-          printf("Timeout on null model.\n");
-          kill(pid, SIGKILL);
-          result = 0;
+          aResults[alive[i]] = results[i];
+          aCompleted[alive[i]] = completed[i];
         }
-        else if (read(pipes[0], &result, sizeof(double) + 1) != sizeof(double))
+        break;
+      }
+
+      double fraction = pow(mRate, static_cast<double>(rung + 1) - mRungs);
+      uint32_t genes = static_cast<uint32_t>(ceil(mNumGenes * fraction)),
+        rows = static_cast<uint32_t>(ceil(mNumTrainingRows * fraction));
+      std::cout << "Halving rung " << (rung + 1) << " of " << mRungs << ": "
+                << alive.size() << " individuals on " << genes
+                << " genes and " << rows << " training arrays" << std::endl;
+      mPool.evaluate(parameters, results, completed, genes, rows);
+
+      // Lower log_2 p values are better; ones which failed have 0.
+      std::vector<std::pair<double, uint32_t> > ranked;
+      for (uint32_t i = 0; i < alive.size(); i++)
+        ranked.push_back(std::pair<double, uint32_t>(results[i], alive[i]));
+      std::sort(ranked.begin(), ranked.end());
+
+      uint32_t keep = static_cast<uint32_t>(ceil(alive.size() / mRate));
+      alive.clear();
+      for (uint32_t i = 0; i < ranked.size(); i++)
+      {
+        if (i < keep)
         {
-          printf("Read error on null model.\n");
-          result = 0;
+          alive.push_back(ranked[i].second);
+          continue;
         }
+
+        std::ostringstream note;
+        note << " stopped at rung " << (rung + 1) << " of " << mRungs
+             << " (" << genes << " genes, " << rows
+             << " training arrays) with log_2 p " << ranked[i].first;
+        aNotes[ranked[i].second] = note.str();
       }
+      std::sort(alive.begin(), alive.end());
     }
-    close(pipes[0]);
-    int status;
-    wait(&status);
+  }
+};
 
-    printf("Returning result: %g\n", result);
+// A checkpoint holds everything needed to carry on a run from the end of a
+// generation without evaluating anything again. Layout (native byte order):
+//   Header.
+//   The random number generator's state, as eoRng writes it, mRngSize bytes.
+//   For each individual: uint32_t valid, double fitness, uint32_t size, and
+//   then size doubles.
+namespace CheckpointFormat
+{
+  static const char kMagic[8] = { 'S', 'V', 'M', 'E', 'A', 'C', 'K', 'P' };
+  static const uint32_t kVersion = 1;
 
-    return result;
-  }
-  return 0;
+  struct Header
+  {
+    char mMagic[8];
+    uint32_t mVersion, mSteadyState;
+    uint64_t mGeneration, mLastImprovement;
+    double mBestSoFar;
+    uint32_t mRngSize, mnIndividuals;
+  };
 }
 
-class EvaluateSVMFit
-  : public eoEvalFunc<Indi>
+// Stops after aMaxGenerations, or after aSteadyGenerations without any
+// improvement once aMinGenerations have passed, as eoGenContinue and
+// eoSteadyFitContinue together do. Unlike those, its counters can be saved
+// and restored, and given a file it saves a checkpoint there after every
+// generation.
+class ResumableContinue
+  : public eoContinue<Indi>
 {
 public:
-  EvaluateSVMFit(GRNModel& aM, GRNModel& aNM, const std::list<std::string>& aTestingSet,
-                 std::list<double>& aLastRun, uint32_t aNumGenes, uint32_t aNumArrays)
-    : mM(aM), mNM(aNM), mTestingSet(aTestingSet), mLastRun(aLastRun),
-      mNumGenes(aNumGenes), mNumArrays(aNumArrays)
+  ResumableContinue(unsigned long aMaxGenerations,
+                    unsigned long aMinGenerations,
+                    unsigned long aSteadyGenerations,
+                    const std::string& aCheckpoint)
+    : mMaxGenerations(aMaxGenerations), mMinGenerations(aMinGenerations),
+      mSteadyGenerations(aSteadyGenerations), mGeneration(0),
+      mLastImprovement(0), mSteadyState(false), mBestSoFar(0.0),
+      mCheckpoint(aCheckpoint)
   {
   }
-  
-  virtual void operator() (Indi & aIndi)
+
+  virtual bool operator() (const eoPop<Indi>& aPop)
   {
-    if (aIndi.invalid())
+    mGeneration++;
+    bool carryOn = true;
+
+    if (mGeneration >= mMaxGenerations)
     {
-      double gamma = exp(aIndi[0]), C = exp(aIndi[1]), nu = aIndi[2];
-      mM.setSVMParameters(gamma, C, nu);
-      mNM.setSVMParameters(gamma, C, nu);
+      std::cout << "STOP: Reached maximum number of generations ["
+                << mGeneration << "/" << mMaxGenerations << "]" << std::endl;
+      carryOn = false;
+    }
 
-      double fitness;
-      if (!mLastRun.empty())
+    Indi::Fitness best = aPop.nth_element_fitness(0);
+    if (mSteadyState)
+    {
+      if (best > mBestSoFar)
       {
-        fitness = mLastRun.front();
-        mLastRun.pop_front();
+        mBestSoFar = best;
+        mLastImprovement = mGeneration;
       }
-      else
-        fitness = safe_svm_evaluator(mM, mNM, mTestingSet, mNumGenes, mNumArrays);
-      aIndi.fitness(fitness);
-      std::cout << "SVM Result: log2 gamma (" << aIndi[0] << ") "
-                   "log2 C (" << aIndi[1] << ") nu (" << aIndi[2]
-                << ") Result (" << fitness << ")"
+      else if (mGeneration - mLastImprovement > mSteadyGenerations)
+      {
+        std::cout << "STOP: Done " << mSteadyGenerations << " generations "
+                  << "without improvement" << std::endl;
+        carryOn = false;
+      }
+    }
+    else if (mGeneration > mMinGenerations)
+    {
+      mSteadyState = true;
+      mBestSoFar = best;
+      mLastImprovement = mGeneration;
+      std::cout << "Done the minimum number of generations" << std::endl;
+    }
+
+    save(aPop);
+    return carryOn;
+  }
+
+  virtual std::string className() const { return "ResumableContinue"; }
+
+  unsigned long getGeneration() const { return mGeneration; }
+
+  // Writes the checkpoint, under another name first so that being killed
+  // part way through never leaves a damaged one behind.
+  bool
+  save(const eoPop<Indi>& aPop)
+  {
+    using namespace CheckpointFormat;
+
+    if (mCheckpoint == "")
+      return true;
+
+    std::ostringstream rngState;
+    rng.printOn(rngState);
+    std::string state(rngState.str());
+
+    Header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.mMagic, kMagic, sizeof(kMagic));
+    h.mVersion = kVersion;
+    h.mSteadyState = mSteadyState;
+    h.mGeneration = mGeneration;
+    h.mLastImprovement = mLastImprovement;
+    h.mBestSoFar = mBestSoFar;
+    h.mRngSize = state.size();
+    h.mnIndividuals = aPop.size();
+
+    std::string temporary(mCheckpoint + ".tmp");
+    FILE* f = fopen(temporary.c_str(), "w");
+    if (f == NULL)
+    {
+      std::cerr << "Couldn't write the checkpoint " << temporary << std::endl;
+      return false;
+    }
+
+    bool ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+      fwrite(state.data(), 1, state.size(), f) == state.size();
+    for (uint32_t i = 0; ok && i < aPop.size(); i++)
+    {
+      const Indi& indi(aPop[i]);
+      uint32_t valid = !indi.invalid(), size = indi.size();
+      double fitness = valid ? static_cast<double>(indi.fitness()) : 0.0;
+      ok = fwrite(&valid, sizeof(valid), 1, f) == 1 &&
+        fwrite(&fitness, sizeof(fitness), 1, f) == 1 &&
+        fwrite(&size, sizeof(size), 1, f) == 1 &&
+        (size == 0 || fwrite(&indi[0], sizeof(double), size, f) == size);
+    }
+
+    if (fclose(f) != 0)
+      ok = false;
+    if (ok)
+      ok = (rename(temporary.c_str(), mCheckpoint.c_str()) == 0);
+    if (!ok)
+    {
+      std::cerr << "Couldn't write the checkpoint " << mCheckpoint
                 << std::endl;
+      unlink(temporary.c_str());
     }
+    return ok;
+  }
+
+  // Restores the population, the random number generator and the counters
+  // from the checkpoint.
+  bool
+  load(eoPop<Indi>& aPop)
+  {
+    using namespace CheckpointFormat;
+
+    FILE* f = fopen(mCheckpoint.c_str(), "r");
+    if (f == NULL)
+      return false;
+
+    Header h;
+    bool ok = fread(&h, sizeof(h), 1, f) == 1 &&
+      memcmp(h.mMagic, kMagic, sizeof(kMagic)) == 0 &&
+      h.mVersion == kVersion;
+
+    std::string state(ok ? h.mRngSize : 0, '\0');
+    ok = ok && (state.empty() ||
+                fread(&state[0], 1, state.size(), f) == state.size());
+
+    eoPop<Indi> pop;
+    for (uint32_t i = 0; ok && i < h.mnIndividuals; i++)
+    {
+      uint32_t valid, size;
+      double fitness;
+      ok = fread(&valid, sizeof(valid), 1, f) == 1 &&
+        fread(&fitness, sizeof(fitness), 1, f) == 1 &&
+        fread(&size, sizeof(size), 1, f) == 1 && size < 1024;
+      if (!ok)
+        break;
+
+      Indi indi(size);
+      ok = (size == 0 || fread(&indi[0], sizeof(double), size, f) == size);
+      if (valid)
+        indi.fitness(fitness);
+      pop.push_back(indi);
+    }
+    fclose(f);
+
+    if (!ok)
+      return false;
+
+    std::istringstream rngState(state);
+    rng.readFrom(rngState);
+    aPop = pop;
+    mSteadyState = h.mSteadyState;
+    mGeneration = h.mGeneration;
+    mLastImprovement = h.mLastImprovement;
+    mBestSoFar = h.mBestSoFar;
+    return true;
   }
 
 private:
-  GRNModel& mM, & mNM;
-  const std::list<std::string>& mTestingSet;
-  std::list<double>& mLastRun;
-  uint32_t mNumGenes, mNumArrays;
+  unsigned long mMaxGenerations, mMinGenerations, mSteadyGenerations,
+    mGeneration, mLastImprovement;
+  bool mSteadyState;
+  Indi::Fitness mBestSoFar;
+  std::string mCheckpoint;
 };
 
 int
@@ -272,7 +989,10 @@ main(int argc, char** argv)
   const unsigned int SEED = 42;	// seed for random number generator
 
   po::options_description desc;
-  std::string matrixdir, model, nullmodel, trainingset, testingset, lastrun;
+  std::string matrixdir, model, nullmodel, trainingset, testingset, lastrun,
+    checkpoint, fitnessCache;
+  uint32_t workers = 1, kernelMemory = 1024, halvingRungs = 1;
+  double halvingRate = 3.0;
 
   desc.add_options()
     ("matrixdir", po::value<std::string>(&matrixdir),
@@ -287,6 +1007,30 @@ main(int argc, char** argv)
      "The list of arrays which have been selected for inclusion in the testing set")
     ("lastrun", po::value<std::string>(&lastrun),
      "The output file from the last run, to re-use scores from (optional)")
+    ("checkpoint", po::value<std::string>(&checkpoint),
+     "A file to save the state of the search in after every generation, "
+     "and to carry on from if it is already there (optional)")
+    ("fitness-cache", po::value<std::string>(&fitnessCache),
+     "A file to keep every score in, so that the same parameters are never "
+     "evaluated twice with the same inputs, even across runs (optional)")
+    ("no-mmap", "Read each array from the data file instead of mapping it")
+    ("workers", po::value<uint32_t>(&workers),
+     "The number of individuals to evaluate at once, each in its own process "
+     "(default 1)")
+    ("kernel-memory", po::value<uint32_t>(&kernelMemory),
+     "Megabytes to keep the distances between training arrays in, so they "
+     "don't have to be worked out again for every individual, counting the "
+     "kernel each worker builds from them while training (default 1024)")
+    ("no-warm-start",
+     "Train every individual from scratch, rather than starting from the "
+     "support vectors found for the nearest earlier individual")
+    ("halving-rungs", po::value<uint32_t>(&halvingRungs),
+     "Score each generation by successive halving over this many rungs, "
+     "only the last of which uses all the genes and training arrays "
+     "(default 1, i.e. score everything in full)")
+    ("halving-rate", po::value<double>(&halvingRate),
+     "At each rung of successive halving, keep the best 1/this of the "
+     "individuals and give them this many times as much data (default 3)")
     ;
 
   po::variables_map vm;
@@ -317,6 +1061,13 @@ main(int argc, char** argv)
     return 1;
   }
   
+  if (halvingRungs == 0 || !(halvingRate > 1.0))
+  {
+    std::cout << "There must be at least one halving rung, and the halving "
+                 "rate must be more than 1." << std::endl;
+    return 1;
+  }
+
   if (!fs::is_directory(matrixdir))
   {
     std::cout << "Matrix directory doesn't exist."
@@ -371,22 +1122,58 @@ main(int argc, char** argv)
     }
   }
 
-  ExpressionMatrixProcessor emp(matrixdir);
+  ExpressionMatrixProcessor emp
+    (matrixdir, vm.count("no-mmap") ? ExpressionMatrixProcessor::kStreamedAccess :
+                ExpressionMatrixProcessor::kMappedRandomAccess);
   GRNModel m(model, emp, 30);
   GRNModel m2(nullmodel, emp, 30);
 
-  std::list<std::string> trainingArrays, testingArrays;
-  m.loadArraySet(trainingset, trainingArrays);
-  m.loadArraySet(testingset, testingArrays);
+  // Every evaluation reuses the same looked up sets.
+  ArraySet trainingArrays, testingArrays;
+  if (!trainingArrays.load(emp, trainingset))
+  {
+    std::cout << "Couldn't use the training set " << trainingset << "."
+              << std::endl;
+    return 1;
+  }
+  if (!testingArrays.load(emp, testingset))
+  {
+    std::cout << "Couldn't use the testing set " << testingset << "."
+              << std::endl;
+    return 1;
+  }
   m.loadSVMTrainingData(trainingArrays);
-  m2.loadArraySet(trainingset, trainingArrays);
-  m2.loadArraySet(testingset, testingArrays);
   m2.loadSVMTrainingData(trainingArrays);
 
+  // The distances are the same for every individual, so work them out before
+  // the evaluators are forked off. Each worker trains one SVM of each model
+  // at a time, with its own copy of the kernel.
+  uint64_t kernelBytes = static_cast<uint64_t>(kernelMemory) << 20;
+  m.precomputeDistances(kernelBytes / 2, workers ? workers : 1);
+  m2.precomputeDistances(kernelBytes / 2, workers ? workers : 1);
+
   // We seed it just so we can restart if need be.
   rng.reseed(SEED);
 
-  EvaluateSVMFit eval(m, m2, trainingArrays, lastRun, 30, testingArrays.size());
+  SVMEvaluationPool evaluationPool(m, m2, testingArrays, 30,
+                                   testingArrays.size(), workers,
+                                   vm.count("no-warm-start") == 0);
+  FitnessCache* cache = NULL;
+  if (fitnessCache != "")
+  {
+    // Anything which changes the scores has to be part of the fingerprint.
+    uint32_t genes = 30, nArrays = emp.getNumArrays();
+    uint64_t inputs = emp.getGeneListFingerprint();
+    inputs = FitnessCache::fingerprint(&genes, sizeof(genes), inputs);
+    inputs = FitnessCache::fingerprint(&nArrays, sizeof(nArrays), inputs);
+    inputs = FitnessCache::fingerprintFile(model, inputs);
+    inputs = FitnessCache::fingerprintFile(nullmodel, inputs);
+    inputs = FitnessCache::fingerprintFile(trainingset, inputs);
+    inputs = FitnessCache::fingerprintFile(testingset, inputs);
+    cache = new FitnessCache(fitnessCache, inputs);
+  }
+  EvaluateSVMFit eval(evaluationPool, lastRun, cache, 30,
+                      trainingArrays.size(), halvingRungs, halvingRate);
 
   std::vector<double> minVals, maxVals;
   // log(gamma)
@@ -402,11 +1189,32 @@ main(int argc, char** argv)
   eoRealVectorBounds rvb(minVals, maxVals);
   eoRealInitBounded<Indi> random(rvb);
 
-  eoPop<Indi> pop(POP_SIZE, random);
-  apply<Indi>(eval, pop);
-  pop.sort();
-  std::cout << "Initial Population" << std::endl;
-  std::cout << pop;
+  ResumableContinue continuator(MAX_GEN, MIN_GEN, STEADY_GEN, checkpoint);
+
+  eoPop<Indi> pop;
+  if (checkpoint != "" && fs::exists(checkpoint))
+  {
+    if (!continuator.load(pop))
+    {
+      std::cout << "Couldn't read the checkpoint " << checkpoint << "."
+                << std::endl;
+      return 1;
+    }
+
+    std::cout << "Resumed Population (generation "
+              << continuator.getGeneration() << ")" << std::endl;
+    std::cout << pop;
+  }
+  else
+  {
+    eoPop<Indi> noParents;
+    pop = eoPop<Indi>(POP_SIZE, random);
+    eval(noParents, pop);
+    pop.sort();
+    std::cout << "Initial Population" << std::endl;
+    std::cout << pop;
+    continuator.save(pop);
+  }
   eoDetTournamentSelect<Indi> selectOne(T_SIZE);
   eoSelectPerc<Indi> select(selectOne);// by default rate==1
   eoGenerationalReplacement<Indi> replace;
@@ -422,18 +1230,16 @@ main(int argc, char** argv)
   mutation.add(mutationD, detMutRate);
   mutation.add(mutationN, normalMutRate, true);
 
-  eoGenContinue<Indi> genCont(MAX_GEN);
-  eoSteadyFitContinue<Indi> steadyCont(MIN_GEN, STEADY_GEN);
-  eoCombinedContinue<Indi> continuator(genCont);
-  continuator.add(steadyCont);
-
   eoSGATransform<Indi> transform(xover, P_CROSS, mutation, P_MUT);
-  eoEasyEA<Indi> gga(continuator, eval, select, transform, replace);
+  eoSelectTransform<Indi> breed(select, transform);
+  eoEasyEA<Indi> gga(continuator, eval, breed, replace);
   gga(pop);
 
   pop.sort();
   std::cout << "Final Population:"
             << std::endl << pop << std::endl;
 
+  delete cache;
+
   return 0;
 }
@@ -0,0 +1,260 @@
+/*
+    Hash index of the gene and array names in a matrix directory
+    Copyright (C) 2008-2009  Andrew Miller
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "NameIndex.hpp"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <unistd.h>
+#include <boost/filesystem.hpp>
+
+namespace fs = boost::filesystem;
+using namespace NameIndexFormat;
+
+NameIndex::NameIndex()
+  : mOffsets(1, 0)
+{
+}
+
+// 64 bit FNV-1a.
+uint64_t
+NameIndex::hash(const char* aName, size_t aLength)
+{
+  uint64_t h = 14695981039346656037ULL;
+  for (size_t i = 0; i < aLength; i++)
+  {
+    h ^= static_cast<unsigned char>(aName[i]);
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+uint32_t
+NameIndex::find(const char* aName, size_t aLength, uint64_t aHash) const
+{
+  if (mSlots.empty())
+    return kNotFound;
+
+  uint32_t mask = mSlots.size() - 1, top = aHash >> 32;
+  for (uint32_t s = aHash & mask; ; s = (s + 1) & mask)
+  {
+    const Slot& slot = mSlots[s];
+    if (slot.mName == kNotFound)
+      return kNotFound;
+    if (slot.mHash != top)
+      continue;
+
+    uint32_t start = mOffsets[slot.mName];
+    if (mOffsets[slot.mName + 1] - start == aLength &&
+        (aLength == 0 || memcmp(&mNames[start], aName, aLength) == 0))
+      return slot.mName;
+  }
+}
+
+uint32_t
+NameIndex::find(const std::string& aName) const
+{
+  return find(aName.data(), aName.size(), hash(aName.data(), aName.size()));
+}
+
+std::string
+NameIndex::getName(uint32_t aIndex) const
+{
+  if (aIndex >= size() || mOffsets[aIndex] == mOffsets[aIndex + 1])
+    return std::string();
+  return std::string(&mNames[mOffsets[aIndex]],
+                     mOffsets[aIndex + 1] - mOffsets[aIndex]);
+}
+
+uint64_t
+NameIndex::getFingerprint() const
+{
+  uint64_t h = hash(NULL, 0);
+  for (uint32_t i = 0; i < size(); i++)
+  {
+    for (uint32_t j = mOffsets[i]; j < mOffsets[i + 1]; j++)
+    {
+      h ^= static_cast<unsigned char>(mNames[j]);
+      h *= 1099511628211ULL;
+    }
+    h ^= '\n';
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+// Builds the hash table for the names, keeping it at most half full.
+void
+NameIndex::build()
+{
+  uint32_t n = size(), nSlots = 16;
+  while (nSlots < 2 * n)
+    nSlots *= 2;
+
+  Slot empty = { kNotFound, 0 };
+  mSlots.assign(nSlots, empty);
+
+  for (uint32_t i = 0; i < n; i++)
+  {
+    const char* name = mNames.empty() ? NULL : &mNames[mOffsets[i]];
+    size_t length = mOffsets[i + 1] - mOffsets[i];
+    uint64_t h = hash(name, length);
+    if (find(name, length, h) != kNotFound)
+      continue;
+
+    uint32_t s = h & (nSlots - 1);
+    while (mSlots[s].mName != kNotFound)
+      s = (s + 1) & (nSlots - 1);
+    mSlots[s].mName = i;
+    mSlots[s].mHash = h >> 32;
+  }
+}
+
+void
+NameIndex::load(const std::string& aListFile, const std::string& aIndexFile)
+{
+  mNames.clear();
+  mOffsets.assign(1, 0);
+  if (!fs::exists(aListFile))
+  {
+    build();
+    return;
+  }
+
+  uint64_t listSize = fs::file_size(aListFile);
+  int64_t listModified = fs::last_write_time(aListFile);
+  if (fs::exists(aIndexFile) &&
+      loadIndex(aIndexFile, listSize, listModified))
+    return;
+
+  std::ifstream lf(aListFile.c_str());
+  while (lf.good())
+  {
+    std::string name;
+    std::getline(lf, name);
+
+    if (!lf.good())
+      break;
+
+    mNames.insert(mNames.end(), name.begin(), name.end());
+    mOffsets.push_back(mNames.size());
+  }
+
+  build();
+  saveIndex(aIndexFile, listSize, listModified);
+}
+
+bool
+NameIndex::loadIndex(const std::string& aIndexFile, uint64_t aListSize,
+                     int64_t aListModified)
+{
+  FILE* f = fopen(aIndexFile.c_str(), "r");
+  if (f == NULL)
+    return false;
+
+  Header h;
+  bool ok = fread(&h, sizeof(h), 1, f) == 1 &&
+    memcmp(h.mMagic, kMagic, sizeof(kMagic)) == 0 &&
+    h.mVersion == kVersion && h.mListSize == aListSize &&
+    h.mListModified == aListModified && h.mnSlots > 0 &&
+    (h.mnSlots & (h.mnSlots - 1)) == 0 &&
+    fs::file_size(aIndexFile) == sizeof(h) +
+    static_cast<uint64_t>(h.mnSlots) * sizeof(Slot) +
+    (static_cast<uint64_t>(h.mnNames) + 1) * sizeof(uint32_t) + h.mNamesSize;
+
+  if (ok)
+  {
+    mSlots.resize(h.mnSlots);
+    mOffsets.resize(static_cast<size_t>(h.mnNames) + 1);
+    mNames.resize(h.mNamesSize);
+    ok = fread(&mSlots[0], sizeof(Slot), mSlots.size(), f) == mSlots.size() &&
+      fread(&mOffsets[0], sizeof(uint32_t), mOffsets.size(), f) ==
+      mOffsets.size() &&
+      (mNames.empty() ||
+       fread(&mNames[0], 1, mNames.size(), f) == mNames.size()) &&
+      mOffsets.front() == 0 && mOffsets.back() == mNames.size();
+  }
+
+  fclose(f);
+
+  // find() trusts the table, so a damaged one is rebuilt rather than used:
+  // every name has to lie within the names, every slot has to point at a
+  // name, and there has to be an empty slot for a search to stop at.
+  for (uint32_t i = 0; ok && i < h.mnNames; i++)
+    ok = (mOffsets[i] <= mOffsets[i + 1]);
+  bool emptySlot = false;
+  for (uint32_t s = 0; ok && s < mSlots.size(); s++)
+  {
+    if (mSlots[s].mName == kNotFound)
+      emptySlot = true;
+    else
+      ok = (mSlots[s].mName < h.mnNames);
+  }
+  ok = ok && emptySlot;
+
+  if (!ok)
+  {
+    mSlots.clear();
+    mOffsets.assign(1, 0);
+    mNames.clear();
+  }
+  return ok;
+}
+
+// Saving is only an optimisation, so failing (e.g. because the directory
+// can't be written to) isn't an error. The index is written under another
+// name first so that nobody else reads it half written.
+bool
+NameIndex::saveIndex(const std::string& aIndexFile, uint64_t aListSize,
+                     int64_t aListModified) const
+{
+  char pid[32];
+  sprintf(pid, ".%d", static_cast<int>(getpid()));
+  std::string temporary(aIndexFile + pid);
+
+  FILE* f = fopen(temporary.c_str(), "w");
+  if (f == NULL)
+    return false;
+
+  Header h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.mMagic, kMagic, sizeof(kMagic));
+  h.mVersion = kVersion;
+  h.mnNames = size();
+  h.mnSlots = mSlots.size();
+  h.mNamesSize = mNames.size();
+  h.mListSize = aListSize;
+  h.mListModified = aListModified;
+
+  bool ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+    fwrite(&mSlots[0], sizeof(Slot), mSlots.size(), f) == mSlots.size() &&
+    fwrite(&mOffsets[0], sizeof(uint32_t), mOffsets.size(), f) ==
+    mOffsets.size() &&
+    (mNames.empty() ||
+     fwrite(&mNames[0], 1, mNames.size(), f) == mNames.size());
+
+  if (fclose(f) != 0)
+    ok = false;
+
+  if (ok)
+    ok = (rename(temporary.c_str(), aIndexFile.c_str()) == 0);
+  if (!ok)
+    unlink(temporary.c_str());
+
+  return ok;
+}
@@ -0,0 +1,110 @@
+/*
+    Hash index of the gene and array names in a matrix directory
+    Copyright (C) 2008-2009  Andrew Miller
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef NAMEINDEX_HPP
+#define NAMEINDEX_HPP
+
+#include <inttypes.h>
+#include <string>
+#include <vector>
+
+// Layout of the saved index (all in native byte order):
+//   Header, at the start of the file.
+//   Slot[mnSlots], the open-addressed hash table.
+//   uint32_t offsets[mnNames + 1]; name i runs from offsets[i] up to
+//   offsets[i + 1] in the names.
+//   The names, back to back.
+// The list it was built from is recorded by its size and modification time,
+// so that a stale index is rebuilt rather than used.
+namespace NameIndexFormat
+{
+  static const char kMagic[8] = { 'S', 'V', 'M', 'N', 'A', 'M', 'E', 'S' };
+  static const uint32_t kVersion = 1;
+
+  struct Header
+  {
+    char mMagic[8];
+    uint32_t mVersion, mnNames, mnSlots, mNamesSize;
+    uint64_t mListSize;
+    int64_t mListModified;
+  };
+
+  // mName is kNotFound for an empty slot. mHash is the top half of the
+  // name's hash, so most mismatches are caught without comparing strings.
+  struct Slot
+  {
+    uint32_t mName, mHash;
+  };
+}
+
+// A set of arrays saved by SampleArrays --format binary, as line numbers in
+// a matrix directory's arrays list (in native byte order):
+//   Header, at the start of the file.
+//   uint32_t arrays[mnArrays], in increasing order.
+// The list's fingerprint is recorded, so that a set made against a
+// different list isn't taken to mean other arrays.
+namespace ArraySetFormat
+{
+  static const char kMagic[8] = { 'S', 'V', 'M', 'A', 'R', 'R', 'S', '\0' };
+  static const uint32_t kVersion = 1;
+
+  struct Header
+  {
+    char mMagic[8];
+    uint32_t mVersion, mnArrays;
+    uint64_t mArrayListFingerprint;
+  };
+}
+
+// Maps each line of a list file (e.g. a matrix directory's genes or arrays)
+// to its line number.
+class NameIndex
+{
+public:
+  static const uint32_t kNotFound = 0xFFFFFFFF;
+
+  NameIndex();
+
+  // Reads the saved index in aIndexFile if it is up to date with aListFile,
+  // and otherwise reads the list and tries to save a new index there.
+  void load(const std::string& aListFile, const std::string& aIndexFile);
+
+  // Returns the line aName is on, or kNotFound. If a name is listed more
+  // than once, the first line is used.
+  uint32_t find(const std::string& aName) const;
+  uint32_t size() const { return mOffsets.size() - 1; }
+  std::string getName(uint32_t aIndex) const;
+  // A hash of every name in order, to tell whether something built against
+  // this list still matches it.
+  uint64_t getFingerprint() const;
+
+private:
+  std::vector<NameIndexFormat::Slot> mSlots;
+  std::vector<uint32_t> mOffsets;
+  std::vector<char> mNames;
+
+  static uint64_t hash(const char* aName, size_t aLength);
+  uint32_t find(const char* aName, size_t aLength, uint64_t aHash) const;
+  void build();
+  bool loadIndex(const std::string& aIndexFile, uint64_t aListSize,
+                 int64_t aListModified);
+  bool saveIndex(const std::string& aIndexFile, uint64_t aListSize,
+                 int64_t aListModified) const;
+};
+
+#endif
@@ -0,0 +1,142 @@
+/*
+    Convert between SVM directories and packed SVM archives.
+    Copyright (C) 2008-2009  Andrew Miller
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <boost/program_options.hpp>
+#include <boost/filesystem.hpp>
+#include <iostream>
+#include "SVMSupport.hpp"
+
+namespace po = boost::program_options;
+namespace fs = boost::filesystem;
+
+int
+main(int argc, char** argv)
+{
+  po::options_description desc;
+  std::string matrixdir, model, svmdir, svmarchive;
+
+  desc.add_options()
+    ("matrixdir", po::value<std::string>(&matrixdir),
+     "The directory set up by SOFT2Matrix")
+    ("model", po::value<std::string>(&model),
+     "The gene regulatory network model the SVMs were trained for")
+    ("svmdir", po::value<std::string>(&svmdir),
+     "The directory containing the support vector machines")
+    ("svmarchive", po::value<std::string>(&svmarchive),
+     "The packed archive of the support vector machines")
+    ("unpack",
+     "Write the archive out to svmdir, rather than packing svmdir into it")
+    ;
+
+  po::variables_map vm;
+
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  std::string wrong;
+  if (!vm.count("help"))
+  {
+    if (!vm.count("matrixdir"))
+      wrong = "matrixdir";
+    else if (!vm.count("model"))
+      wrong = "model";
+    else if (!vm.count("svmdir"))
+      wrong = "svmdir";
+    else if (!vm.count("svmarchive"))
+      wrong = "svmarchive";
+  }
+
+  if (wrong != "")
+    std::cerr << "Missing option: " << wrong << std::endl;
+  if (vm.count("help") || wrong != "")
+  {
+    std::cout << desc << std::endl;
+    return 1;
+  }
+
+  bool unpack = (vm.count("unpack") != 0);
+
+  if (!fs::is_directory(matrixdir))
+  {
+    std::cout << "Matrix directory doesn't exist."
+              << std::endl;
+    return 1;
+  }
+
+  if (!fs::is_regular(model))
+  {
+    std::cout << "Model file doesn't exist or not regular file."
+              << std::endl;
+    return 1;
+  }
+
+  if (unpack && !fs::is_regular(svmarchive))
+  {
+    std::cout << "SVM archive doesn't exist or not regular file."
+              << std::endl;
+    return 1;
+  }
+
+  if (!fs::is_directory(svmdir))
+  {
+    if (!unpack)
+    {
+      std::cout << "SVM directory doesn't exist."
+                << std::endl;
+      return 1;
+    }
+
+    fs::path p(svmdir);
+    try
+    {
+      fs::create_directory(p);
+    }
+    catch (std::exception& e)
+    {
+      std::cout << "SVM directory doesn't exist and couldn't be created: "
+                << e.what() << std::endl;
+      return 1;
+    }
+  }
+
+  // The model is needed to know how many regulators each SVM has; a feature
+  // which is zero in every support vector doesn't appear in libsvm's files.
+  ExpressionMatrixProcessor emp(matrixdir);
+  GRNModel m(model, emp);
+
+  if (unpack)
+  {
+    if (!m.loadSVMArchive(svmarchive))
+    {
+      std::cout << "Couldn't read the SVM archive." << std::endl;
+      return 1;
+    }
+    m.saveSVMs(svmdir);
+  }
+  else
+  {
+    m.loadSVMs(svmdir);
+    if (!m.saveSVMArchive(svmarchive))
+    {
+      std::cout << "Couldn't write the SVM archive." << std::endl;
+      return 1;
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,236 @@
+/*
+    Packed binary archive of trained SVMs
+    Copyright (C) 2008-2009  Andrew Miller
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "SVMArchive.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace SVMArchiveFormat;
+
+static const uint64_t kAlignment = 64;
+
+static uint64_t
+align(uint64_t aOffset)
+{
+  return (aOffset + kAlignment - 1) / kAlignment * kAlignment;
+}
+
+static bool
+pad(FILE* aFile, uint64_t aFrom, uint64_t aTo)
+{
+  static const char zeros[kAlignment] = { 0 };
+  return aTo == aFrom || fwrite(zeros, aTo - aFrom, 1, aFile) == 1;
+}
+
+static bool
+byGene(const std::pair<std::string, const DenseRBFModel*>& aEntry1,
+       const std::pair<std::string, const DenseRBFModel*>& aEntry2)
+{
+  return aEntry1.first < aEntry2.first;
+}
+
+void
+SVMArchiveWriter::add(const std::string& aGene, const DenseRBFModel& aModel)
+{
+  mEntries.push_back(Entry(aGene, &aModel));
+}
+
+bool
+SVMArchiveWriter::write(const std::string& aFilename)
+{
+  std::sort(mEntries.begin(), mEntries.end(), byGene);
+
+  Header h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.mMagic, kMagic, sizeof(kMagic));
+  h.mVersion = kVersion;
+  h.mnModels = mEntries.size();
+  h.mIndexOffset = sizeof(Header);
+  h.mNamesOffset = h.mIndexOffset + sizeof(IndexEntry) * mEntries.size();
+
+  // Work out where everything goes before writing any of it.
+  std::vector<IndexEntry> index(mEntries.size());
+  uint64_t names = 0;
+  for (uint32_t i = 0; i < mEntries.size(); i++)
+  {
+    index[i].mNameOffset = names;
+    index[i].mNameLength = mEntries[i].first.size();
+    index[i].mReserved = 0;
+    names += mEntries[i].first.size();
+  }
+
+  uint64_t offset = align(h.mNamesOffset + names);
+  for (uint32_t i = 0; i < mEntries.size(); i++)
+  {
+    const DenseRBFModel& m(*mEntries[i].second);
+    index[i].mModelOffset = offset;
+    offset = align(offset + sizeof(ModelHeader) + sizeof(double) *
+                   static_cast<uint64_t>(m.getStride()) *
+                   (m.getDimensions() + 1));
+  }
+
+  FILE* f = fopen(aFilename.c_str(), "w");
+  if (f == NULL)
+    return false;
+
+  bool ok = (fwrite(&h, sizeof(h), 1, f) == 1);
+  if (ok && !index.empty())
+    ok = (fwrite(&index[0], sizeof(IndexEntry), index.size(), f) ==
+          index.size());
+  for (uint32_t i = 0; ok && i < mEntries.size(); i++)
+    ok = mEntries[i].first.empty() ||
+      (fwrite(mEntries[i].first.data(), mEntries[i].first.size(), 1, f) == 1);
+
+  uint64_t at = h.mNamesOffset + names;
+  for (uint32_t i = 0; ok && i < mEntries.size(); i++)
+  {
+    const DenseRBFModel& m(*mEntries[i].second);
+    ok = pad(f, at, index[i].mModelOffset);
+
+    ModelHeader mh;
+    memset(&mh, 0, sizeof(mh));
+    mh.mDimensions = m.getDimensions();
+    mh.mnSV = m.getNumSupportVectors();
+    mh.mGamma = m.getGamma();
+    mh.mRho = m.getRho();
+
+    size_t stride = m.getStride();
+    ok = ok && (fwrite(&mh, sizeof(mh), 1, f) == 1) &&
+      (stride == 0 ||
+       (fwrite(m.getCoefficients(), sizeof(double), stride, f) == stride &&
+        (m.getDimensions() == 0 ||
+         fwrite(m.getSupportVectors(), sizeof(double) * stride,
+                m.getDimensions(), f) == m.getDimensions())));
+
+    at = index[i].mModelOffset + sizeof(ModelHeader) +
+      sizeof(double) * stride * (m.getDimensions() + 1);
+  }
+
+  if (fclose(f) != 0)
+    ok = false;
+
+  return ok;
+}
+
+SVMArchive::SVMArchive(const std::string& aFilename)
+  : mMapping(NULL), mSize(0), mHeader(NULL)
+{
+  int fd = open(aFilename.c_str(), O_RDONLY);
+  if (fd < 0)
+    return;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 ||
+      static_cast<size_t>(st.st_size) < sizeof(Header))
+  {
+    close(fd);
+    return;
+  }
+
+  void* m = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (m == MAP_FAILED)
+    return;
+
+  const Header* h = static_cast<const Header*>(m);
+  if (memcmp(h->mMagic, kMagic, sizeof(kMagic)) != 0 ||
+      h->mVersion != kVersion ||
+      h->mNamesOffset > static_cast<uint64_t>(st.st_size) ||
+      h->mIndexOffset + sizeof(IndexEntry) * h->mnModels > h->mNamesOffset)
+  {
+    std::cerr << aFilename << " isn't an SVM archive this version can read."
+              << std::endl;
+    munmap(m, st.st_size);
+    return;
+  }
+
+  mMapping = m;
+  mSize = st.st_size;
+  mHeader = h;
+}
+
+SVMArchive::~SVMArchive()
+{
+  if (mMapping != NULL)
+    munmap(mMapping, mSize);
+}
+
+uint32_t
+SVMArchive::getNumModels() const
+{
+  return mHeader ? mHeader->mnModels : 0;
+}
+
+bool
+SVMArchive::find(const std::string& aGene, DenseRBFModel& aModel) const
+{
+  if (mHeader == NULL)
+    return false;
+
+  const char* base = static_cast<const char*>(mMapping);
+  const IndexEntry* index =
+    reinterpret_cast<const IndexEntry*>(base + mHeader->mIndexOffset);
+  const char* names = base + mHeader->mNamesOffset;
+  uint64_t namesSize = mSize - mHeader->mNamesOffset;
+
+  // Binary search on the names in the file, so nothing has to be parsed up
+  // front.
+  uint32_t low = 0, high = mHeader->mnModels;
+  while (low < high)
+  {
+    uint32_t mid = low + (high - low) / 2;
+    const IndexEntry& e(index[mid]);
+    if (e.mNameOffset > namesSize ||
+        e.mNameLength > namesSize - e.mNameOffset)
+      return false;
+
+    int c = aGene.compare(0, std::string::npos, names + e.mNameOffset,
+                          e.mNameLength);
+    if (c > 0)
+      low = mid + 1;
+    else if (c < 0)
+      high = mid;
+    else
+    {
+      if (e.mModelOffset + sizeof(ModelHeader) > mSize)
+        return false;
+
+      const ModelHeader* mh =
+        reinterpret_cast<const ModelHeader*>(base + e.mModelOffset);
+      uint64_t stride = DenseRBFModel::getStride(mh->mnSV);
+      const double* coef =
+        reinterpret_cast<const double*>(base + e.mModelOffset +
+                                        sizeof(ModelHeader));
+      if (e.mModelOffset + sizeof(ModelHeader) +
+          sizeof(double) * stride * (mh->mDimensions + 1) > mSize)
+        return false;
+
+      aModel.attach(mh->mDimensions, mh->mnSV, mh->mGamma, mh->mRho,
+                    coef, coef + stride);
+      return true;
+    }
+  }
+
+  return false;
+}
@@ -0,0 +1,97 @@
+/*
+    Packed binary archive of trained SVMs
+    Copyright (C) 2008-2009  Andrew Miller
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SVMARCHIVE_HPP
+#define SVMARCHIVE_HPP
+
+#include <inttypes.h>
+#include <string>
+#include <vector>
+#include "DenseRBFModel.hpp"
+
+// Layout (all in native byte order):
+//   Header, at the start of the file.
+//   IndexEntry[mnModels], sorted by gene name, at mIndexOffset.
+//   The gene names, back to back, at mNamesOffset.
+//   For each model, on a 64 byte boundary: a ModelHeader, then the
+//   coefficients and then the support vectors exactly as DenseRBFModel
+//   holds them, so they can be used straight out of the mapped file.
+namespace SVMArchiveFormat
+{
+  static const char kMagic[8] = { 'S', 'V', 'M', 'A', 'R', 'C', 'H', '\0' };
+  static const uint32_t kVersion = 1;
+
+  struct Header
+  {
+    char mMagic[8];
+    uint32_t mVersion, mnModels;
+    uint64_t mIndexOffset, mNamesOffset;
+    uint64_t mReserved[4];
+  };
+
+  struct IndexEntry
+  {
+    uint64_t mNameOffset;
+    uint32_t mNameLength, mReserved;
+    uint64_t mModelOffset;
+  };
+
+  struct ModelHeader
+  {
+    uint32_t mDimensions, mnSV;
+    double mGamma, mRho;
+    uint64_t mReserved[5];
+  };
+}
+
+class SVMArchiveWriter
+{
+public:
+  // The models must stay around until write() is called.
+  void add(const std::string& aGene, const DenseRBFModel& aModel);
+  bool write(const std::string& aFilename);
+
+private:
+  typedef std::pair<std::string, const DenseRBFModel*> Entry;
+  std::vector<Entry> mEntries;
+};
+
+// Maps an archive into memory. Nothing is read until a model is used.
+class SVMArchive
+{
+public:
+  SVMArchive(const std::string& aFilename);
+  ~SVMArchive();
+
+  bool isValid() const { return mMapping != NULL; }
+  uint32_t getNumModels() const;
+
+  // Points aModel at the model for aGene in the archive, returning false if
+  // there isn't one.
+  bool find(const std::string& aGene, DenseRBFModel& aModel) const;
+
+private:
+  void* mMapping;
+  size_t mSize;
+  const SVMArchiveFormat::Header* mHeader;
+
+  SVMArchive(const SVMArchive&);
+  SVMArchive& operator=(const SVMArchive&);
+};
+
+#endif
@@ -19,335 +19,1659 @@
 #include "SVMSupport.hpp"
 #include <boost/program_options.hpp>
 #include <boost/filesystem.hpp>
-#include <boost/regex.hpp>
 #include <iostream>
 #include <fstream>
 #include <math.h>
-#include <boost/tokenizer.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <algorithm>
+#include <iterator>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 namespace po = boost::program_options;
 namespace fs = boost::filesystem;
 
 ExpressionMatrixProcessor::ExpressionMatrixProcessor
 (
- const std::string& aMatrixDir
+ const std::string& aMatrixDir,
+ AccessMode aMode,
+ bool aSinglePrecision
 )
-  : mDataFile(NULL), mRow(NULL)
+  : mDataFile(NULL), mRow(NULL), mRowBuffer(NULL), mMissingRow(NULL),
+    mMissingRowFloat(NULL), mMapping(NULL),
+    mMappingSize(0), mAccessMode(aMode), mSinglePrecision(false),
+    mCompressed(NULL), mReadAheadRows(kDefaultReadAheadRows), mAheadRead(0),
+    mAheadNext(0), mAheadStop(false), mAheadThread(NULL),
+    mGeneDataFile(NULL), mColumnBuffer(NULL), mGeneMapping(NULL),
+    mGeneMappingSize(0)
 {
   fs::path md(aMatrixDir);
 
   {
-    fs::path arraylist(md);
+    fs::path arraylist(md), arrayindex(md);
     arraylist /= "arrays";
+    arrayindex /= "arrays.index";
+    mArrayIndices.load(arraylist.string(), arrayindex.string());
+    mnArrays = mArrayIndices.size();
+  }
+
+  {
+    fs::path genelist(md), geneindex(md);
+    genelist /= "genes";
+    geneindex /= "genes.index";
+    mGeneIndices.load(genelist.string(), geneindex.string());
+    mnGenes = mGeneIndices.size();
+  }
+
+  mRowBuffer = new double[mnGenes];
+  mRow = mRowBuffer;
+
+  {
+    fs::path datafile(md);
+    datafile /= "data";
 
-    std::ifstream af(arraylist.string().c_str());
-    uint32_t index = 0;
-    
-    while (af.good())
+    if (aSinglePrecision)
     {
-      std::string array;
-      std::getline(af, array);
+      fs::path floatfile(md);
+      floatfile /= "data32";
+      if (fs::exists(floatfile))
+      {
+        datafile = floatfile;
+        mSinglePrecision = true;
+      }
+      else
+        std::cerr << "No data32 in " << aMatrixDir << "; reading doubles. "
+                  << "Run ConvertMatrix to make one." << std::endl;
+    }
+    size_t valueSize = mSinglePrecision ? sizeof(float) : sizeof(double);
 
-      if (!af.good())
-        break;
-      
-      mArrayIndices.insert(std::pair<std::string, uint32_t>(array, index++));
+    fs::path compressed(md);
+    compressed /= "dataz";
+    if (!mSinglePrecision && !fs::exists(datafile) && fs::exists(compressed))
+    {
+      mCompressed = new CompressedMatrix(compressed.string());
+      if (!mCompressed->isValid() || mCompressed->getNumGenes() != mnGenes ||
+          mCompressed->getNumArrays() != mnArrays)
+      {
+        std::cerr << "Ignoring " << compressed.string() << ": its size "
+                  << "doesn't match the genes and arrays lists." << std::endl;
+        delete mCompressed;
+        mCompressed = NULL;
+      }
     }
 
-    mnArrays = index;
+    // If the map fails (e.g. no address space left), just fall back to
+    // reading each array as it is needed.
+    if (aMode != kStreamedAccess && mCompressed == NULL)
+      mMapping = mapFile(datafile.string(), mMappingSize);
+    if (mCompressed != NULL)
+      setAccessMode(mAccessMode);
+    else if (mMapping == NULL)
+    {
+      mAccessMode = kStreamedAccess;
+      mDataFile = fopen(datafile.string().c_str(), "r");
+    }
+    else
+    {
+      setAccessMode(mAccessMode);
+
+      // Arrays past the end of a truncated data file have no data.
+      if (mMappingSize < static_cast<size_t>(mnGenes) * mnArrays * valueSize)
+      {
+        mMissingRow = new double[mnGenes];
+        mMissingRowFloat = new float[mnGenes];
+        for (uint32_t i = 0; i < mnGenes; i++)
+        {
+          mMissingRow[i] = std::numeric_limits<double>::quiet_NaN();
+          mMissingRowFloat[i] = std::numeric_limits<float>::quiet_NaN();
+        }
+      }
+    }
   }
 
   {
-    fs::path genelist(md);
-    genelist /= "genes";
+    fs::path genedata(md);
+    genedata /= "genedata";
+
+    if (fs::exists(genedata))
+      openGeneMajorData(genedata.string());
+  }
+}
 
-    std::ifstream gf(genelist.string().c_str());
-    uint32_t index = 0;
+ExpressionMatrixProcessor::~ExpressionMatrixProcessor()
+{
+  stopReadAhead();
+  if (mDataFile != NULL)
+    fclose(mDataFile);
+  if (mMapping != NULL)
+    munmap(mMapping, mMappingSize);
+  if (mRowBuffer)
+    delete [] mRowBuffer;
+  if (mMissingRow)
+    delete [] mMissingRow;
+  if (mMissingRowFloat)
+    delete [] mMissingRowFloat;
+  if (mCompressed)
+    delete mCompressed;
+  if (mGeneDataFile != NULL)
+    fclose(mGeneDataFile);
+  if (mGeneMapping != NULL)
+    munmap(mGeneMapping, mGeneMappingSize);
+  if (mColumnBuffer)
+    delete [] mColumnBuffer;
+}
+
+void*
+ExpressionMatrixProcessor::mapFile(const std::string& aFile, size_t& aSize)
+{
+  int fd = open(aFile.c_str(), O_RDONLY);
+  if (fd < 0)
+    return NULL;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0)
+  {
+    close(fd);
+    return NULL;
+  }
+
+  void* m = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  // The mapping keeps its own reference to the file.
+  close(fd);
+
+  if (m == MAP_FAILED)
+    return NULL;
+
+  aSize = st.st_size;
+  return m;
+}
+
+void
+ExpressionMatrixProcessor::openGeneMajorData(const std::string& aFile)
+{
+  size_t expected = static_cast<size_t>(mnGenes) * mnArrays * sizeof(double);
+  if (fs::file_size(aFile) != expected)
+  {
+    std::cerr << "Ignoring " << aFile << ": its size doesn't match the "
+              << "genes and arrays lists; re-run TransposeMatrix." << std::endl;
+    return;
+  }
+
+  if (mAccessMode != kStreamedAccess)
+    mGeneMapping = mapFile(aFile, mGeneMappingSize);
+
+  if (mGeneMapping != NULL)
+  {
+    // Only a few genes' columns are ever needed.
+    madvise(mGeneMapping, mGeneMappingSize, MADV_RANDOM);
+    return;
+  }
+
+  mGeneDataFile = fopen(aFile.c_str(), "r");
+  mColumnBuffer = new double[mnArrays];
+}
+
+const double*
+ExpressionMatrixProcessor::getGeneColumn(uint32_t aGene)
+{
+  size_t offset = static_cast<size_t>(aGene) * mnArrays * sizeof(double);
+
+  if (mGeneMapping != NULL)
+    return reinterpret_cast<const double*>
+      (static_cast<const char*>(mGeneMapping) + offset);
+
+  fseek(mGeneDataFile, offset, SEEK_SET);
+  fread(mColumnBuffer, mnArrays * sizeof(double), 1, mGeneDataFile);
+  return mColumnBuffer;
+}
+
+void
+ExpressionMatrixProcessor::setAccessMode(AccessMode aMode)
+{
+  // Compressed data is read in order by decompressing ahead of the reader.
+  if (mCompressed != NULL && aMode == kMappedSequentialAccess)
+  {
+    std::vector<uint32_t> all(mnArrays);
+    for (uint32_t i = 0; i < mnArrays; i++)
+      all[i] = i;
+    mCompressed->prefetch(all);
+  }
+
+  if (mMapping == NULL)
+    return;
 
-    while (gf.good())
+  mAccessMode = aMode;
+  madvise(mMapping, mMappingSize,
+          aMode == kMappedSequentialAccess ? MADV_SEQUENTIAL : MADV_RANDOM);
+}
+
+void
+ExpressionMatrixProcessor::setArray
+(
+ uint32_t aArray
+)
+{
+  if (mAheadThread != NULL)
+  {
+    boost::unique_lock<boost::mutex> lock(mAheadMutex);
+    if (mAheadNext < mAheadSequence.size() &&
+        mAheadSequence[mAheadNext] == aArray)
     {
-      std::string gene;
-      std::getline(gf, gene);
+      while (mAheadRead <= mAheadNext)
+        mAheadChanged.wait(lock);
+      mRow = mAheadRows[mAheadNext % mAheadRows.size()];
+      mAheadNext++;
+      mAheadChanged.notify_all();
+      return;
+    }
+  }
 
-      if (!gf.good())
-        break;
+  mRow = readArray(aArray, mRowBuffer);
+}
+
+void
+ExpressionMatrixProcessor::startReadAhead(const std::vector<uint32_t>& aArrays)
+{
+  stopReadAhead();
+  if (mReadAheadRows == 0 || aArrays.empty())
+    return;
+
+  uint32_t slots = mReadAheadRows + 1;
+  mAheadSequence = aArrays;
+  mAheadBuffers.resize(slots);
+  for (uint32_t i = 0; i < slots; i++)
+    mAheadBuffers[i].resize(mnGenes);
+  mAheadRows.assign(slots, NULL);
+  mAheadRead = 0;
+  mAheadNext = 0;
+  mAheadStop = false;
+  mAheadThread = new boost::thread
+    (boost::bind(&ExpressionMatrixProcessor::readAheadLoop, this));
+}
+
+void
+ExpressionMatrixProcessor::stopReadAhead()
+{
+  if (mAheadThread == NULL)
+    return;
+
+  {
+    boost::unique_lock<boost::mutex> lock(mAheadMutex);
+    mAheadStop = true;
+    mAheadChanged.notify_all();
+  }
+  mAheadThread->join();
+  delete mAheadThread;
+  mAheadThread = NULL;
+
+  // mRow may still point at one of the buffers.
+  for (size_t i = 0; i < mAheadBuffers.size(); i++)
+    if (mRow == &mAheadBuffers[i][0])
+    {
+      std::copy(mRow, mRow + mnGenes, mRowBuffer);
+      mRow = mRowBuffer;
+    }
+}
+
+void
+ExpressionMatrixProcessor::readAheadLoop()
+{
+  size_t slots = mAheadRows.size(),
+    stride = sysconf(_SC_PAGESIZE) / sizeof(double);
+  boost::unique_lock<boost::mutex> lock(mAheadMutex);
 
-      mGeneIndices.insert(std::pair<std::string, uint32_t>(gene, index++));
+  while (!mAheadStop && mAheadRead < mAheadSequence.size())
+  {
+    if (mAheadRead >= mAheadNext + mReadAheadRows)
+    {
+      mAheadChanged.wait(lock);
+      continue;
     }
 
-    mnGenes = index;
+    size_t p = mAheadRead;
+    lock.unlock();
+    const double* row = readArray(mAheadSequence[p],
+                                  &mAheadBuffers[p % slots][0]);
+    // A mapped row hasn't really been read until its pages are touched.
+    if (row != &mAheadBuffers[p % slots][0])
+    {
+      const volatile double* touch = row;
+      for (size_t i = 0; i < mnGenes; i += stride)
+        touch[i];
+    }
+    lock.lock();
+
+    mAheadRows[p % slots] = row;
+    mAheadRead++;
+    mAheadChanged.notify_all();
   }
+}
+
+// Returns the row as it is stored in the data file, either in the mapping
+// or read into aBuffer, or NULL if the mapped file doesn't reach that far.
+const void*
+ExpressionMatrixProcessor::readRawArray
+(
+ uint32_t aArray,
+ void* aBuffer
+)
+{
+  size_t rowSize = mnGenes * (mSinglePrecision ? sizeof(float) :
+                              sizeof(double));
+  size_t offset = static_cast<size_t>(aArray) * rowSize;
 
+  if (mCompressed != NULL)
   {
-    fs::path datafile(md);
-    datafile /= "data";
+    mCompressed->readArray(aArray, static_cast<double*>(aBuffer));
+    return aBuffer;
+  }
 
-    mDataFile = fopen(datafile.string().c_str(), "r");
+  if (mMapping == NULL)
+  {
+    pread(fileno(mDataFile), aBuffer, rowSize, offset);
+    return aBuffer;
   }
 
-  mRow = new double[mnGenes];
+  if (offset + rowSize <= mMappingSize)
+    return static_cast<const char*>(mMapping) + offset;
+
+  return NULL;
 }
 
-ExpressionMatrixProcessor::~ExpressionMatrixProcessor()
+bool
+ExpressionMatrixProcessor::loadBinaryArraySet
+(
+ const std::string& aFilename,
+ std::vector<uint32_t>& aArrays,
+ bool& aBinary
+) const
+{
+  using namespace ArraySetFormat;
+
+  aBinary = false;
+  FILE* f = fopen(aFilename.c_str(), "r");
+  if (f == NULL)
+    return false;
+
+  Header h;
+  if (fread(&h, sizeof(h), 1, f) != 1 ||
+      memcmp(h.mMagic, kMagic, sizeof(kMagic)) != 0)
+  {
+    fclose(f);
+    return false;
+  }
+  aBinary = true;
+
+  aArrays.clear();
+  if (h.mVersion != kVersion ||
+      h.mArrayListFingerprint != getArrayListFingerprint())
+  {
+    std::cerr << "The array set " << aFilename << " was made for a "
+              << "different arrays list." << std::endl;
+    fclose(f);
+    return false;
+  }
+
+  aArrays.resize(h.mnArrays);
+  bool truncated = h.mnArrays != 0 &&
+    fread(&aArrays[0], sizeof(uint32_t), h.mnArrays, f) != h.mnArrays;
+  fclose(f);
+  if (truncated)
+  {
+    std::cerr << "The array set " << aFilename << " is truncated."
+              << std::endl;
+    aArrays.clear();
+    return false;
+  }
+
+  std::vector<uint32_t>::iterator kept = aArrays.begin();
+  for (std::vector<uint32_t>::iterator i = aArrays.begin();
+       i != aArrays.end();
+       i++)
+    if (*i < mnArrays)
+      *kept++ = *i;
+  aArrays.erase(kept, aArrays.end());
+  return true;
+}
+
+void
+ExpressionMatrixProcessor::prefetchArrays(const std::vector<uint32_t>& aArrays)
+{
+  if (mCompressed != NULL)
+    mCompressed->prefetch(aArrays);
+  else if (!aArrays.empty())
+    willNeedArrays(&aArrays[0], aArrays.size());
+}
+
+void
+ExpressionMatrixProcessor::willNeedArrays(const uint32_t* aArrays,
+                                          size_t aCount)
+{
+  if (mCompressed != NULL || (mMapping == NULL && mDataFile == NULL))
+    return;
+
+  size_t rowSize = mnGenes * (mSinglePrecision ? sizeof(float) :
+                              sizeof(double));
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t i = 0;
+  while (i < aCount)
+  {
+    // Take in every following array which is next to the last one.
+    size_t j = i + 1;
+    while (j < aCount && aArrays[j] == aArrays[j - 1] + 1)
+      j++;
+
+    size_t start = static_cast<size_t>(aArrays[i]) * rowSize,
+      end = (static_cast<size_t>(aArrays[j - 1]) + 1) * rowSize;
+    i = j;
+
+    if (mMapping == NULL)
+    {
+      posix_fadvise(fileno(mDataFile), start, end - start,
+                    POSIX_FADV_WILLNEED);
+      continue;
+    }
+
+    if (start >= mMappingSize)
+      continue;
+    end = std::min(end, mMappingSize);
+    start -= start % page;
+    madvise(static_cast<char*>(mMapping) + start, end - start,
+            MADV_WILLNEED);
+  }
+}
+
+const double*
+ExpressionMatrixProcessor::readArray
+(
+ uint32_t aArray,
+ double* aBuffer
+)
+{
+  if (!mSinglePrecision)
+  {
+    const void* row = readRawArray(aArray, aBuffer);
+    return row ? static_cast<const double*>(row) : mMissingRow;
+  }
+
+  // The floats are read into the back half of aBuffer, so that widening them
+  // from the front never overwrites one which hasn't been read yet.
+  float* back = reinterpret_cast<float*>(aBuffer) + mnGenes;
+  const float* row = static_cast<const float*>(readRawArray(aArray, back));
+  if (row == NULL)
+    return mMissingRow;
+
+  for (uint32_t i = 0; i < mnGenes; i++)
+    aBuffer[i] = row[i];
+  return aBuffer;
+}
+
+const float*
+ExpressionMatrixProcessor::readArrayFloat
+(
+ uint32_t aArray,
+ float* aBuffer
+)
+{
+  if (mSinglePrecision)
+  {
+    const void* row = readRawArray(aArray, aBuffer);
+    return row ? static_cast<const float*>(row) : mMissingRowFloat;
+  }
+
+  const double* row;
+  std::vector<double> buffer;
+  if (mMapping == NULL)
+  {
+    buffer.resize(mnGenes);
+    row = static_cast<const double*>(readRawArray(aArray, &buffer[0]));
+  }
+  else
+    row = static_cast<const double*>(readRawArray(aArray, NULL));
+
+  if (row == NULL)
+    return mMissingRowFloat;
+
+  for (uint32_t i = 0; i < mnGenes; i++)
+    aBuffer[i] = row[i];
+  return aBuffer;
+}
+
+ArraySet::ArraySet(const std::vector<uint32_t>& aArrays)
+  : mListed(aArrays)
+{
+  normalise();
+}
+
+void
+ArraySet::normalise()
+{
+  mArrays = mListed;
+  std::sort(mArrays.begin(), mArrays.end());
+  mArrays.erase(std::unique(mArrays.begin(), mArrays.end()), mArrays.end());
+}
+
+bool
+ArraySet::load(const ExpressionMatrixProcessor& aEMP,
+               const std::string& aFilename)
+{
+  bool binary;
+  if (aEMP.loadBinaryArraySet(aFilename, mListed, binary))
+  {
+    normalise();
+    return true;
+  }
+  if (binary)
+    return false;
+
+  std::ifstream s(aFilename.c_str());
+  if (!s.good())
+    return false;
+
+  std::vector<std::string> names;
+  while (s.good())
+  {
+    std::string l;
+    std::getline(s, l);
+
+    if (l != "")
+      names.push_back(l);
+  }
+
+  lookUp(aEMP, names, mListed);
+  normalise();
+  return true;
+}
+
+ArraySet
+ArraySet::intersect(const ArraySet& aOther) const
+{
+  ArraySet result;
+  std::set_intersection(mArrays.begin(), mArrays.end(),
+                        aOther.mArrays.begin(), aOther.mArrays.end(),
+                        std::back_inserter(result.mArrays));
+  return result;
+}
+
+ArraySet
+ArraySet::subtract(const ArraySet& aOther) const
+{
+  ArraySet result;
+  std::set_difference(mArrays.begin(), mArrays.end(),
+                      aOther.mArrays.begin(), aOther.mArrays.end(),
+                      std::back_inserter(result.mArrays));
+  return result;
+}
+
+ArraySet
+ArraySet::slice(size_t aFirst, size_t aCount) const
+{
+  ArraySet result;
+  aFirst = std::min(aFirst, mArrays.size());
+  aCount = std::min(aCount, mArrays.size() - aFirst);
+  result.mArrays.assign(mArrays.begin() + aFirst,
+                        mArrays.begin() + aFirst + aCount);
+  return result;
+}
+
+void
+ArraySet::split(const std::vector<uint32_t>& aParts,
+                std::vector<ArraySet>& aSets) const
+{
+  // Going through in order keeps every part sorted.
+  for (size_t i = 0; i < mArrays.size(); i++)
+  {
+    if (aParts[i] >= aSets.size())
+      aSets.resize(aParts[i] + 1);
+    aSets[aParts[i]].mArrays.push_back(mArrays[i]);
+  }
+}
+
+RegulatorMatrix::RegulatorMatrix()
+  : mnArrays(0), mMaskWords(0)
 {
-  if (mDataFile != NULL)
-    fclose(mDataFile);
-  if (mRow)
-    delete [] mRow;
 }
 
 uint32_t
-ExpressionMatrixProcessor::getIndexOfGene(const std::string& aGene)
+RegulatorMatrix::addGene(uint32_t aGene)
+{
+  std::map<uint32_t, uint32_t>::iterator i = mColumnsByGene.find(aGene);
+  if (i != mColumnsByGene.end())
+    return i->second;
+
+  uint32_t c = mGenes.size();
+  mColumnsByGene.insert(std::pair<uint32_t, uint32_t>(aGene, c));
+  mGenes.push_back(aGene);
+  return c;
+}
+
+void
+RegulatorMatrix::load(ExpressionMatrixProcessor& aEMP,
+                      const std::vector<uint32_t>& aArrays)
+{
+  uint32_t nColumns = mGenes.size();
+  mnArrays = aArrays.size();
+  mMaskWords = (mnArrays + 63) / 64;
+  mValues.assign(static_cast<size_t>(nColumns) * mnArrays, 0.0);
+  mMask.assign(static_cast<size_t>(nColumns) * mMaskWords, 0);
+
+  if (aEMP.hasGeneMajorData())
+  {
+    for (uint32_t c = 0; c < nColumns; c++)
+    {
+      const double* g = aEMP.getGeneColumn(mGenes[c]);
+      double* v = &mValues[static_cast<size_t>(c) * mnArrays];
+      for (uint32_t a = 0; a < mnArrays; a++)
+        v[a] = g[aArrays[a]];
+    }
+  }
+  else
+  {
+    // The rows are read on another thread while the last ones are copied.
+    aEMP.prefetchArrays(aArrays);
+    aEMP.startReadAhead(aArrays);
+    for (uint32_t a = 0; a < mnArrays; a++)
+    {
+      aEMP.setArray(aArrays[a]);
+      const double* row = aEMP.getRow();
+      for (uint32_t c = 0; c < nColumns; c++)
+        mValues[static_cast<size_t>(c) * mnArrays + a] = row[mGenes[c]];
+    }
+    aEMP.stopReadAhead();
+  }
+
+  for (uint32_t c = 0; c < nColumns; c++)
+  {
+    const double* v = &mValues[static_cast<size_t>(c) * mnArrays];
+    uint64_t* m = &mMask[static_cast<size_t>(c) * mMaskWords];
+    for (uint32_t a = 0; a < mnArrays; a++)
+      if (isfinite(v[a]))
+        m[a / 64] |= static_cast<uint64_t>(1) << (a % 64);
+  }
+}
+
+SupportVectorMachine::SupportVectorMachine
+(
+ ExpressionMatrixProcessor& aEMP,
+ const std::string& aRegulatedGene,
+ uint32_t aNumRegulators
+)
+  : mEMP(aEMP), mRegulatedGene(aEMP.getIndexOfGene(aRegulatedGene)),
+    mNumRegulators(aNumRegulators), mModel(NULL), mGamma(0.1), mC(0.1),
+    mNu(0.1), mTestNodes(NULL), mRegulatedGeneName(aRegulatedGene),
+    mDenseModel(NULL), mTrainingData(NULL), mCacheLimit(100), mRowLimit(0)
+{
+  mRegulatingGenes.reserve(aNumRegulators);
+
+  mTestNodes = new svm_node[mNumRegulators + 1];
+}
+
+SupportVectorMachine::~SupportVectorMachine()
+{
+  if (mModel)
+    svm_destroy_model(mModel);
+
+  if (mTestNodes)
+  {
+    delete mTestNodes;
+  }
+
+  if (mDenseModel)
+    delete mDenseModel;
+}
+
+void
+SupportVectorMachine::addRegulatingGene(uint32_t aRegulatingGene)
 {
-  return mGeneIndices[aGene];
+  mRegulatingGenes.push_back(aRegulatingGene);
+}
+
+void
+SupportVectorMachine::useTrainingData(RegulatorMatrix& aMatrix)
+{
+  mTrainingData = &aMatrix;
+  mColumns.clear();
+  for (std::vector<uint32_t>::iterator j = mRegulatingGenes.begin();
+       j != mRegulatingGenes.end(); j++)
+    mColumns.push_back(aMatrix.addGene(*j));
+  mColumns.push_back(aMatrix.addGene(mRegulatedGene));
+}
+
+void
+SupportVectorMachine::findUsableArrays()
+{
+  // We just ignore the whole array if there are NaNs...
+  uint32_t nWords = mTrainingData->getMaskWords();
+  std::vector<uint64_t> usable(mTrainingData->getMask(mColumns.back()),
+                               mTrainingData->getMask(mColumns.back()) +
+                               nWords);
+  for (uint32_t k = 0; k < mNumRegulators; k++)
+  {
+    const uint64_t* m = mTrainingData->getMask(mColumns[k]);
+    for (uint32_t w = 0; w < nWords; w++)
+      usable[w] &= m[w];
+  }
+
+  mUsableArrays.clear();
+  for (uint32_t a = 0; a < mTrainingData->getNumArrays(); a++)
+    if (usable[a / 64] & (static_cast<uint64_t>(1) << (a % 64)))
+      mUsableArrays.push_back(a);
+
+  std::vector<double>().swap(mDistances);
+  mWarmStart.clear();
+}
+
+void
+SupportVectorMachine::precomputeDistances()
+{
+  if (mNumRegulators == 0)
+    return;
+
+  uint32_t l = mUsableArrays.size();
+  mDistances.assign(static_cast<size_t>(l) * (l + 1) / 2, 0.0);
+
+  // A regulator at a time, so each column is only gathered once.
+  std::vector<double> x(l);
+  for (uint32_t k = 0; k < mNumRegulators; k++)
+  {
+    const double* c = mTrainingData->getColumn(mColumns[k]);
+    for (uint32_t i = 0; i < l; i++)
+      x[i] = c[mUsableArrays[i]];
+
+    double* d = &mDistances[0];
+    for (uint32_t i = 0; i < l; i++)
+      for (uint32_t j = 0; j <= i; j++)
+      {
+        double diff = x[i] - x[j];
+        *d++ += diff * diff;
+      }
+  }
+}
+
+void
+SupportVectorMachine::train()
+{
+  // Handle this case specially so we can make the simplifying assumption that
+  // mNumRegulators > 0 later...
+  if (mNumRegulators == 0)
+  {
+    const double* y = mTrainingData->getColumn(mColumns.back());
+    uint32_t l = getNumTrainingRows();
+    double sum = 0.0;
+    for (uint32_t i = 0; i < l; i++)
+      sum += y[mUsableArrays[i]];
+    mAverage = sum / l;
+    return;
+  }
+
+  mParameter.svm_type = NU_SVR;
+  mParameter.kernel_type = RBF;
+  mParameter.degree = 3;
+  mParameter.gamma = mGamma;
+  mParameter.coef0 = 0;
+  mParameter.p = 0;
+  mParameter.C = mC;
+  mParameter.eps = 1E-3;
+  mParameter.nu = mNu;
+  mParameter.shrinking = 1;
+  mParameter.probability = 0;
+  mParameter.nr_weight = 0;
+  mParameter.weight_label = NULL;
+  mParameter.weight = NULL;
+
+  uint32_t l = getNumTrainingRows();
+  if (!mWarmStart.empty() && trainFromWarmStart())
+    return;
+
+  std::vector<uint32_t> rows(l);
+  for (uint32_t i = 0; i < l; i++)
+    rows[i] = i;
+  trainOnRows(rows, mNu);
 }
 
 uint32_t
-ExpressionMatrixProcessor::getIndexOfArray(const std::string& aArray)
+SupportVectorMachine::getNumTrainingRows()
+{
+  uint32_t l = mUsableArrays.size();
+  return (mRowLimit != 0 && mRowLimit < l) ? mRowLimit : l;
+}
+
+void
+SupportVectorMachine::setWarmStart(const std::vector<uint32_t>& aSupportRows)
+{
+  mWarmStart = aSupportRows;
+}
+
+bool
+SupportVectorMachine::trainFromWarmStart()
+{
+  // libsvm can't be handed a starting point for its solver, so instead train
+  // on just the rows which were support vectors for nearby parameters, and
+  // then add in any other rows which don't fit inside the tube. With nu
+  // scaled up so the sum of the alphas stays C * nu * l, once every row left
+  // out fits, the solution is the same as training on all of them.
+  uint32_t l = getNumTrainingRows();
+  std::vector<uint32_t> rows;
+  for (std::vector<uint32_t>::iterator i = mWarmStart.begin();
+       i != mWarmStart.end(); i++)
+    if (*i < l)
+      rows.push_back(*i);
+  std::sort(rows.begin(), rows.end());
+  rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+
+  std::vector<double> features(static_cast<size_t>(l) * mNumRegulators);
+  for (uint32_t k = 0; k < mNumRegulators; k++)
+  {
+    const double* c = mTrainingData->getColumn(mColumns[k]);
+    for (uint32_t i = 0; i < l; i++)
+      features[static_cast<size_t>(i) * mNumRegulators + k] =
+        c[mUsableArrays[i]];
+  }
+  const double* y = mTrainingData->getColumn(mColumns.back());
+  std::vector<double> predictions(l);
+
+  for (uint32_t round = 0; round < kWarmStartRounds; round++)
+  {
+    if (rows.empty() || rows.size() * 2 > l ||
+        mNu * l / rows.size() > 1.0)
+      return false;
+
+    trainOnRows(rows, mNu * l / rows.size());
+    if (mDenseModel == NULL)
+      return false;
+    mDenseModel->predict(&features[0], l, &predictions[0]);
+
+    // The free support vectors sit on the edge of the tube, so they give
+    // its width.
+    double epsilon = 0.0;
+    uint32_t nFree = 0;
+    for (int i = 0; i < mModel->l; i++)
+    {
+      double a = fabs(mModel->sv_coef[0][i]);
+      if (a >= mC * (1 - 1E-6))
+        continue;
+      uint32_t r = mSupportRows[i];
+      epsilon += fabs(y[mUsableArrays[r]] - predictions[r]);
+      nFree++;
+    }
+    if (nFree == 0)
+      return false;
+    epsilon = epsilon / nFree + mParameter.eps;
+
+    std::vector<bool> inRows(l, false);
+    for (std::vector<uint32_t>::iterator i = rows.begin(); i != rows.end();
+         i++)
+      inRows[*i] = true;
+
+    std::vector<uint32_t> violators;
+    for (uint32_t r = 0; r < l; r++)
+      if (!inRows[r] && fabs(y[mUsableArrays[r]] - predictions[r]) > epsilon)
+        violators.push_back(r);
+
+    if (violators.empty())
+    {
+      mModel->param.nu = mNu;
+      return true;
+    }
+
+    std::vector<uint32_t> merged;
+    std::merge(rows.begin(), rows.end(), violators.begin(), violators.end(),
+               std::back_inserter(merged));
+    rows.swap(merged);
+  }
+
+  return false;
+}
+
+void
+SupportVectorMachine::trainOnRows(const std::vector<uint32_t>& aRows,
+                                  double aNu)
 {
-  return mArrayIndices[aArray];
+  if (mModel != NULL)
+    svm_destroy_model(mModel);
+
+  // The problem only exists while libsvm is training on it; the support
+  // vectors are copied out of it afterwards.
+  mParameter.kernel_type = RBF;
+  mParameter.nu = aNu;
+  struct svm_problem problem;
+  svm_node* nodes;
+  if (mDistances.empty())
+    buildProblem(aRows, problem, nodes);
+  else
+  {
+    buildPrecomputedProblem(aRows, problem, nodes);
+    mParameter.kernel_type = PRECOMPUTED;
+  }
+
+  // libsvm caches columns of l floats; there's no point in letting it have
+  // room for more than all of them.
+  double needed = 1.0 + static_cast<double>(problem.l) * problem.l *
+    sizeof(float) / (1 << 20);
+  mParameter.cache_size = std::min(mCacheLimit, needed);
+
+  mModel = svm_train(&problem, &mParameter);
+  compactSupportVectors(aRows, nodes);
+
+  delete [] nodes;
+  delete [] problem.x;
+  delete [] problem.y;
+
+  buildDenseModel();
+}
+
+void
+SupportVectorMachine::buildProblem(const std::vector<uint32_t>& aRows,
+                                   struct svm_problem& aProblem,
+                                   svm_node*& aNodes)
+{
+  uint32_t l = aRows.size(), width = mNumRegulators + 1;
+  aProblem.l = l;
+  aProblem.y = new double[l];
+  aProblem.x = new svm_node*[l];
+  aNodes = new svm_node[static_cast<size_t>(l) * width];
+
+  const double* y = mTrainingData->getColumn(mColumns.back());
+  for (uint32_t i = 0; i < l; i++)
+  {
+    aProblem.y[i] = y[mUsableArrays[aRows[i]]];
+    aProblem.x[i] = aNodes + static_cast<size_t>(i) * width;
+    aProblem.x[i][mNumRegulators].index = -1;
+  }
+
+  for (uint32_t k = 0; k < mNumRegulators; k++)
+  {
+    const double* c = mTrainingData->getColumn(mColumns[k]);
+    for (uint32_t i = 0; i < l; i++)
+    {
+      aProblem.x[i][k].index = k + 1;
+      aProblem.x[i][k].value = c[mUsableArrays[aRows[i]]];
+    }
+  }
+}
+
+void
+SupportVectorMachine::buildPrecomputedProblem
+(
+ const std::vector<uint32_t>& aRows,
+ struct svm_problem& aProblem,
+ svm_node*& aNodes
+)
+{
+  // In libsvm's precomputed format, node 0 of each row holds its (1 based)
+  // number and node j holds the kernel value against row j.
+  uint32_t l = aRows.size(), width = l + 2;
+  aProblem.l = l;
+  aProblem.y = new double[l];
+  aProblem.x = new svm_node*[l];
+  aNodes = new svm_node[static_cast<size_t>(l) * width];
+
+  const double* y = mTrainingData->getColumn(mColumns.back());
+  for (uint32_t i = 0; i < l; i++)
+  {
+    aProblem.y[i] = y[mUsableArrays[aRows[i]]];
+    svm_node* x = aNodes + static_cast<size_t>(i) * width;
+    aProblem.x[i] = x;
+    x[0].index = 0;
+    x[0].value = i + 1;
+    x[l + 1].index = -1;
+  }
+
+  // aRows is in increasing order, so row i's distances to rows j <= i are
+  // all in the packed triangle under aRows[i].
+  for (uint32_t i = 0; i < l; i++)
+  {
+    const double* d = &mDistances[static_cast<size_t>(aRows[i]) *
+                                  (aRows[i] + 1) / 2];
+    for (uint32_t j = 0; j <= i; j++)
+    {
+      double k = exp(-mGamma * d[aRows[j]]);
+      aProblem.x[i][j + 1].index = j + 1;
+      aProblem.x[i][j + 1].value = k;
+      aProblem.x[j][i + 1].index = i + 1;
+      aProblem.x[j][i + 1].value = k;
+    }
+  }
+}
+
+void
+SupportVectorMachine::compactSupportVectors(const std::vector<uint32_t>& aRows,
+                                            const svm_node* aNodes)
+{
+  // libsvm frees SV[0] as one block when free_sv is set, as it does for the
+  // models it loads, so every support vector goes into one malloc'd block.
+  uint32_t width = mNumRegulators + 1;
+  bool precomputed = (mModel->param.kernel_type == PRECOMPUTED);
+
+  // A precomputed model is turned back into the RBF model it is equivalent
+  // to, with the support vectors found from their row numbers.
+  mModel->param.kernel_type = RBF;
+
+  mSupportRows.resize(mModel->l);
+  if (mModel->l == 0)
+    return;
+
+  svm_node* sv = static_cast<svm_node*>
+    (malloc(sizeof(svm_node) * width * mModel->l));
+  for (int i = 0; i < mModel->l; i++)
+  {
+    uint32_t r;
+    if (precomputed)
+      r = aRows[static_cast<uint32_t>(mModel->SV[i][0].value) - 1];
+    else
+      r = aRows[(mModel->SV[i] - aNodes) / width];
+    mSupportRows[i] = r;
+
+    svm_node* p = sv + static_cast<size_t>(i) * width;
+    for (uint32_t k = 0; k < mNumRegulators; k++)
+    {
+      p[k].index = k + 1;
+      p[k].value = mTrainingData->getColumn(mColumns[k])[mUsableArrays[r]];
+    }
+    p[mNumRegulators].index = -1;
+    mModel->SV[i] = p;
+  }
+  mModel->free_sv = 1;
+}
+
+void
+SupportVectorMachine::buildDenseModel()
+{
+  if (mModel == NULL || mModel->param.kernel_type != RBF ||
+      (mModel->param.svm_type != NU_SVR &&
+       mModel->param.svm_type != EPSILON_SVR))
+  {
+    delete mDenseModel;
+    mDenseModel = NULL;
+    return;
+  }
+
+  if (mDenseModel == NULL)
+    mDenseModel = new DenseRBFModel();
+  mDenseModel->build(mModel, mNumRegulators);
+}
+
+static bool
+trainsLonger(SupportVectorMachine* aSVM1, SupportVectorMachine* aSVM2)
+{
+  return aSVM1->getTrainingCost() > aSVM2->getTrainingCost();
+}
+
+void
+GRNModel::loadSVMTrainingData(const std::vector<uint32_t>& aArrays)
+{
+  for (std::list<SupportVectorMachine*>::iterator i = mSVMs.begin();
+       i != mSVMs.end();
+       i++)
+    (*i)->useTrainingData(mTrainingData);
+
+  mTrainingData.load(mEMP, aArrays);
+
+  for (std::list<SupportVectorMachine*>::iterator i = mSVMs.begin();
+       i != mSVMs.end();
+       i++)
+    (*i)->findUsableArrays();
+}
+
+void
+GRNModel::setTrainingRowLimit(uint32_t aRows)
+{
+  for (std::list<SupportVectorMachine*>::iterator i = mSVMs.begin();
+       i != mSVMs.end();
+       i++)
+    (*i)->setTrainingRowLimit(aRows);
+}
+
+void
+GRNModel::truncateSVMs(uint32_t aCount)
+{
+  while (mSVMs.size() > aCount)
+  {
+    delete mSVMs.back();
+    mSVMs.pop_back();
+  }
+}
+
+void
+GRNModel::precomputeDistances(uint64_t aMaxBytes, uint32_t aTrainers)
+{
+  // Any of the SVMs with distances might be the one being trained, so room
+  // is kept for the largest of their problems in each trainer.
+  uint64_t used = 0, largestProblem = 0;
+  for (std::list<SupportVectorMachine*>::iterator i = mSVMs.begin();
+       i != mSVMs.end();
+       i++)
+  {
+    uint64_t bytes = (*i)->getDistanceBytes(),
+      problem = std::max(largestProblem, (*i)->getPrecomputedProblemBytes());
+    if (used + bytes + problem * aTrainers > aMaxBytes)
+      continue;
+
+    (*i)->precomputeDistances();
+    used += bytes;
+    largestProblem = problem;
+  }
+}
+
+void
+GRNModel::getSupportRows(std::vector<uint32_t>& aRows)
+{
+  for (std::list<SupportVectorMachine*>::iterator i = mSVMs.begin();
+       i != mSVMs.end();
+       i++)
+  {
+    const std::vector<uint32_t>& rows((*i)->getSupportRows());
+    aRows.push_back(rows.size());
+    aRows.insert(aRows.end(), rows.begin(), rows.end());
+  }
+}
+
+void
+GRNModel::setWarmStart(const uint32_t*& aRows, const uint32_t* aEnd)
+{
+  std::vector<uint32_t> rows;
+  for (std::list<SupportVectorMachine*>::iterator i = mSVMs.begin();
+       i != mSVMs.end();
+       i++)
+  {
+    rows.clear();
+    if (aRows < aEnd && *aRows <= static_cast<size_t>(aEnd - aRows - 1))
+    {
+      rows.assign(aRows + 1, aRows + 1 + *aRows);
+      aRows += 1 + *aRows;
+    }
+    else
+      aRows = aEnd;
+    (*i)->setWarmStart(rows);
+  }
+}
+
+// Splits half of the free memory between the threads training at once, for
+// libsvm's kernel caches.
+void
+GRNModel::setCacheLimits(uint32_t aNumThreads)
+{
+  double limit = 100;
+  long pages = sysconf(_SC_AVPHYS_PAGES), pageSize = sysconf(_SC_PAGESIZE);
+  if (pages > 0 && pageSize > 0)
+    limit = std::max(40.0, static_cast<double>(pages) * pageSize / (1 << 20) /
+                     2 / std::max(aNumThreads, 1u));
+
+  for (std::list<SupportVectorMachine*>::iterator i = mSVMs.begin();
+       i != mSVMs.end();
+       i++)
+    (*i)->setCacheLimit(limit);
+}
+
+void
+GRNModel::getSVMsByTrainingCost(std::vector<SupportVectorMachine*>& aSVMs)
+{
+  aSVMs.assign(mSVMs.begin(), mSVMs.end());
+  std::stable_sort(aSVMs.begin(), aSVMs.end(), trainsLonger);
+}
+
+void
+GRNModel::trainSVMs(uint32_t aNumThreads)
+{
+  setCacheLimits(aNumThreads);
+
+  if (aNumThreads <= 1)
+  {
+    for (std::list<SupportVectorMachine*>::iterator i = mSVMs.begin();
+         i != mSVMs.end();
+         i++)
+      (*i)->train();
+    return;
+  }
+
+  // Each SVM only touches its own problem and model, so they can be trained
+  // in any order without changing the results.
+  std::vector<SupportVectorMachine*> svms;
+  getSVMsByTrainingCost(svms);
+
+  ThreadPool pool(aNumThreads);
+  for (std::vector<SupportVectorMachine*>::iterator i = svms.begin();
+       i != svms.end();
+       i++)
+    pool.add(boost::bind(&SupportVectorMachine::train, *i));
+  pool.run();
+}
+
+// libsvm's model reader and writer switch the locale, so aren't safe to run
+// from several threads at once.
+static boost::mutex gSaveLock;
+
+void
+GRNModel::trainAndSaveSVM(SupportVectorMachine* aSVM,
+                          const std::string& aSVMDir, bool aDontReplace)
+{
+  fs::path targ(aSVMDir);
+  targ /= aSVM->getRegulatedGeneName();
+
+  // A model which is kept is read back in, so that the SVM ends up the same
+  // as if it had been trained, e.g. for saveSVMArchive().
+  if (fs::is_regular(targ) && aDontReplace)
+  {
+    boost::mutex::scoped_lock l(gSaveLock);
+    aSVM->load(targ.string());
+    return;
+  }
+
+  aSVM->train();
+
+  boost::mutex::scoped_lock l(gSaveLock);
+  aSVM->save(targ.string());
 }
 
 void
-ExpressionMatrixProcessor::setArray
-(
- uint32_t aArray
-)
+GRNModel::trainAndSaveSVMs(const std::string& aSVMDir, bool aDontReplace,
+                           uint32_t aNumThreads)
 {
-  fseek(mDataFile, aArray * mnGenes * sizeof(double), SEEK_SET);
-  fread(mRow, mnGenes * sizeof(double), 1, mDataFile);
+  setCacheLimits(aNumThreads);
+
+  std::vector<SupportVectorMachine*> svms;
+  if (aNumThreads <= 1)
+    svms.assign(mSVMs.begin(), mSVMs.end());
+  else
+    getSVMsByTrainingCost(svms);
+
+  ThreadPool pool(aNumThreads);
+  for (std::vector<SupportVectorMachine*>::iterator i = svms.begin();
+       i != svms.end();
+       i++)
+    pool.add(boost::bind(&GRNModel::trainAndSaveSVM, this, *i, aSVMDir,
+                         aDontReplace));
+  pool.run();
 }
 
-double
-ExpressionMatrixProcessor::getDataPoint
-(
- uint32_t aGene
-)
+void
+SupportVectorMachine::save(const std::string& aFilename)
 {
-  return mRow[aGene];
+  // Models from an archive only exist in dense form.
+  if (mModel == NULL && mDenseModel != NULL)
+    mDenseModel->saveAsLibSVM(aFilename);
+  else
+    svm_save_model(aFilename.c_str(), mModel);
 }
 
-SupportVectorMachine::SupportVectorMachine
-(
- ExpressionMatrixProcessor& aEMP,
- const std::string& aRegulatedGene,
- uint32_t aNumRegulators
-)
-  : mEMP(aEMP), mRegulatedGene(aEMP.getIndexOfGene(aRegulatedGene)),
-    mNumRegulators(aNumRegulators), mModel(NULL), mGamma(0.1), mC(0.1),
-    mNu(0.1), mTestNodes(NULL), mRegulatedGeneName(aRegulatedGene)
+void
+SupportVectorMachine::load(const std::string& aFilename)
 {
-  mRegulatingGenes.reserve(aNumRegulators);
-  mProblem.y = NULL;
-  mProblem.x = NULL;
+  if (mModel)
+    svm_destroy_model(mModel);
 
-  mTestNodes = new svm_node[mNumRegulators + 1];
+  mModel = svm_load_model(aFilename.c_str());
+
+  assert(mModel);
+  buildDenseModel();
 }
 
-SupportVectorMachine::~SupportVectorMachine()
+bool
+SupportVectorMachine::loadFromArchive(const SVMArchive& aArchive)
 {
   if (mModel)
+  {
     svm_destroy_model(mModel);
+    mModel = NULL;
+  }
 
-  if (mProblem.y)
-    delete [] mProblem.y;
+  if (mDenseModel == NULL)
+    mDenseModel = new DenseRBFModel();
 
-  if (mProblem.x)
-  {
-    if (mProblem.x[0])
-      delete [] mProblem.x[0];
-    delete [] mProblem.x;
-  }
+  if (aArchive.find(mRegulatedGeneName, *mDenseModel) &&
+      mDenseModel->getDimensions() == mNumRegulators)
+    return true;
 
-  if (mTestNodes)
-  {
-    delete mTestNodes;
-  }
+  delete mDenseModel;
+  mDenseModel = NULL;
+  return false;
 }
 
-void
-SupportVectorMachine::addRegulatingGene(uint32_t aRegulatingGene)
+double
+SupportVectorMachine::testOnRow()
 {
-  mRegulatingGenes.push_back(aRegulatingGene);
+  return testOnRow(mEMP.getRow(), mTestNodes);
 }
 
-void
-SupportVectorMachine::setupProblem(uint32_t aSize)
+double
+SupportVectorMachine::testOnRow(const double* aRow, svm_node* aNodes)
 {
-  // Handle this case specially so we can make the simplifying assumption that
-  // mNumRegulators > 0 later...
-  if (mNumRegulators == 0)
+  // We just ignore the whole array if there are NaNs...
+  svm_node* p = aNodes;
+  uint32_t k = 1;
+  for (std::vector<uint32_t>::iterator j = mRegulatingGenes.begin();
+       j != mRegulatingGenes.end(); j++)
   {
-    mNumFinite = 0;
-    mSum = 0.0;
-    return;
+    double v(aRow[*j]);
+    if (!isfinite(v))
+      return std::numeric_limits<double>::quiet_NaN();
+    else
+    {
+      p->index = k++;
+      p->value = v;
+      p++;
+    }
   }
 
-  mProblem.l = 0;
-  mProblem.y = new double[aSize];
-  mProblem.x = new svm_node*[aSize];
+  p->index = -1;
 
-  double* yp = mProblem.y;
-  svm_node** xp = mProblem.x;
-  svm_node* p = new svm_node[aSize * (mNumRegulators + 1)];
+  double answer = aRow[mRegulatedGene];
+  if (!isfinite(answer))
+    return std::numeric_limits<double>::quiet_NaN();
 
-  for (uint32_t i = 0; i < aSize; i++)
+  if (mModel == NULL)
   {
-    xp[i] = p;
-    p += (mNumRegulators + 1);
+    if (mDenseModel == NULL)
+      return std::numeric_limits<double>::quiet_NaN();
+
+    double r;
+    SVMTestScratch scratch;
+    testOnRows(&aRow, 1, &r, 1, scratch, aNodes);
+    return r;
   }
 
-  mYp = mProblem.y;
-  mXp = mProblem.x;
+  double x = (svm_predict(mModel, aNodes) - answer);
+  return x * x;
 }
 
 void
-SupportVectorMachine::loadTrainingRow()
+SupportVectorMachine::testOnRows(const double* const* aRows, uint32_t aCount,
+                                 double* aResults, size_t aResultStride,
+                                 SVMTestScratch& aScratch, svm_node* aNodes)
 {
-  if (mNumRegulators == 0)
+  if (mDenseModel == NULL)
   {
-    double rgl = mEMP.getDataPoint(mRegulatedGene);
-    if (!isfinite(rgl))
-      return;
-    
-    mNumFinite++;
-    mSum += rgl;
-
+    for (uint32_t r = 0; r < aCount; r++)
+      aResults[r * aResultStride] = testOnRow(aRows[r], aNodes);
     return;
   }
 
-  bool containsNaNs = false;
+  // Gather up the rows without NaNs, predict them together, and then put
+  // the errors back in place.
+  aScratch.mFeatures.resize(aCount * mNumRegulators);
+  aScratch.mAnswers.resize(aCount);
+  aScratch.mRows.clear();
 
-  for (std::vector<uint32_t>::iterator j = mRegulatingGenes.begin();
-       j != mRegulatingGenes.end(); j++)
-    if (!isfinite(mEMP.getDataPoint(*j)))
-      containsNaNs = true;
+  double* f = &aScratch.mFeatures[0];
+  for (uint32_t r = 0; r < aCount; r++)
+  {
+    const double* row = aRows[r];
+    aResults[r * aResultStride] = std::numeric_limits<double>::quiet_NaN();
 
-  // We just ignore the whole array if there are NaNs...
-  if (containsNaNs)
-    return;
+    double answer = row[mRegulatedGene];
+    if (!isfinite(answer))
+      continue;
 
-  if (!isfinite(mEMP.getDataPoint(mRegulatedGene)))
-    return;
+    uint32_t k = 0;
+    for (; k < mNumRegulators; k++)
+    {
+      f[k] = row[mRegulatingGenes[k]];
+      if (!isfinite(f[k]))
+        break;
+    }
+    if (k != mNumRegulators)
+      continue;
+
+    aScratch.mAnswers[aScratch.mRows.size()] = answer;
+    aScratch.mRows.push_back(r);
+    f += mNumRegulators;
+  }
 
-  mProblem.l++;
+  uint32_t n = aScratch.mRows.size();
+  if (n == 0)
+    return;
 
-  *mYp++ = mEMP.getDataPoint(mRegulatedGene);
-  svm_node* p;
-  p = *mXp++;
+  aScratch.mPredictions.resize(n);
+  mDenseModel->predict(&aScratch.mFeatures[0], n, &aScratch.mPredictions[0]);
 
-  uint32_t k = 1;
-  for (std::vector<uint32_t>::iterator j = mRegulatingGenes.begin();
-       j != mRegulatingGenes.end(); p++, j++, k++)
+  for (uint32_t i = 0; i < n; i++)
   {
-    p->index = k;
-    p->value = mEMP.getDataPoint(*j);
+    double x = aScratch.mPredictions[i] - aScratch.mAnswers[i];
+    aResults[aScratch.mRows[i] * aResultStride] = x * x;
   }
-  p->index = -1;
 }
 
 void
-SupportVectorMachine::train()
+SupportVectorMachine::prepareSinglePrecision()
 {
-  // Handle this case specially so we can make the simplifying assumption that
-  // mNumRegulators > 0 later...
-  if (mNumRegulators == 0)
+  if (mDenseModel != NULL)
+    mDenseModel->prepareSinglePrecision();
+}
+
+void
+SupportVectorMachine::testOnRows(const float* const* aRows, uint32_t aCount,
+                                 double* aResults, size_t aResultStride,
+                                 SVMTestScratch& aScratch)
+{
+  if (mDenseModel == NULL || !mDenseModel->hasSinglePrecision())
   {
-    mAverage = mSum / mNumFinite;
+    for (uint32_t r = 0; r < aCount; r++)
+      aResults[r * aResultStride] = std::numeric_limits<double>::quiet_NaN();
     return;
   }
 
-  mParameter.svm_type = NU_SVR;
-  mParameter.kernel_type = RBF;
-  mParameter.degree = 3;
-  mParameter.gamma = mGamma;
-  mParameter.coef0 = 0;
-  mParameter.p = 0;
-  mParameter.cache_size = 100;
-  mParameter.C = mC;
-  mParameter.eps = 1E-3;
-  mParameter.nu = mNu;
-  mParameter.shrinking = 1;
-  mParameter.probability = 0;
-  mParameter.nr_weight = 0;
-  mParameter.weight_label = NULL;
-  mParameter.weight = NULL;
+  aScratch.mFloatFeatures.resize(aCount * mNumRegulators);
+  aScratch.mAnswers.resize(aCount);
+  aScratch.mRows.clear();
 
-  if (mModel != NULL)
-    svm_destroy_model(mModel);
+  float* f = &aScratch.mFloatFeatures[0];
+  for (uint32_t r = 0; r < aCount; r++)
+  {
+    const float* row = aRows[r];
+    aResults[r * aResultStride] = std::numeric_limits<double>::quiet_NaN();
+
+    float answer = row[mRegulatedGene];
+    if (!isfinite(answer))
+      continue;
+
+    uint32_t k = 0;
+    for (; k < mNumRegulators; k++)
+    {
+      f[k] = row[mRegulatingGenes[k]];
+      if (!isfinite(f[k]))
+        break;
+    }
+    if (k != mNumRegulators)
+      continue;
 
-  mModel = svm_train(&mProblem, &mParameter);
+    aScratch.mAnswers[aScratch.mRows.size()] = answer;
+    aScratch.mRows.push_back(r);
+    f += mNumRegulators;
+  }
+
+  uint32_t n = aScratch.mRows.size();
+  if (n == 0)
+    return;
+
+  aScratch.mPredictions.resize(n);
+  mDenseModel->predict(&aScratch.mFloatFeatures[0], n,
+                       &aScratch.mPredictions[0]);
+
+  for (uint32_t i = 0; i < n; i++)
+  {
+    double x = aScratch.mPredictions[i] - aScratch.mAnswers[i];
+    aResults[aScratch.mRows[i] * aResultStride] = x * x;
+  }
 }
 
 void
-GRNModel::trainAndSaveSVMs(const std::string& aSVMDir, bool aDontReplace)
+GRNModel::setSinglePrecision(bool aSingle)
 {
-  fs::path dir(aSVMDir);
-  
+  mSinglePrecision = aSingle;
+  if (!aSingle)
+    return;
+
   for (std::list<SupportVectorMachine*>::iterator i = mSVMs.begin();
        i != mSVMs.end();
        i++)
-  {
-    (*i)->train();
-    fs::path targ(dir);
-    if (fs::is_regular(targ) && aDontReplace)
-      continue;
-    targ /= (*i)->getRegulatedGeneName();
-    (*i)->save(targ.string());
-  }
+    (*i)->prepareSinglePrecision();
 }
 
 void
-SupportVectorMachine::save(const std::string& aFilename)
+GRNModel::testArrayBatch(const uint32_t* aArrays, size_t aCount,
+                         std::vector<double>& aResults, uint32_t aNumThreads)
 {
-  svm_save_model(aFilename.c_str(), mModel);
+  std::vector<SupportVectorMachine*> svms(mSVMs.begin(), mSVMs.end());
+  aResults.resize(aCount * svms.size());
+
+  // Cut the batch up finer than the number of threads, so that a thread
+  // which gets slow arrays can have some of its work stolen.
+  size_t shard = aCount / (aNumThreads * 4);
+  if (shard == 0)
+    shard = 1;
+  if (shard > kTestShardArrays)
+    shard = kTestShardArrays;
+
+  ThreadPool pool(aNumThreads);
+  for (size_t first = 0; first < aCount; first += shard)
+    pool.add(boost::bind(&GRNModel::testArrayShard, this, &svms,
+                         aArrays + first, std::min(shard, aCount - first),
+                         &aResults[0] + first * svms.size()));
+  pool.run();
 }
 
 void
-SupportVectorMachine::load(const std::string& aFilename)
+GRNModel::testArrayShard(const std::vector<SupportVectorMachine*>* aSVMs,
+                         const uint32_t* aArrays, size_t aCount,
+                         double* aResults)
 {
-  if (mModel)
-    svm_destroy_model(mModel);
+  uint32_t maxRegulators = 0;
+  for (std::vector<SupportVectorMachine*>::const_iterator j = aSVMs->begin();
+       j != aSVMs->end();
+       j++)
+    maxRegulators = std::max(maxRegulators, (*j)->getNumRegulators());
+
+  // Every row in the shard is needed at once, so each SVM can predict them
+  // all in one go.
+  uint32_t nGenes = mEMP.getNumGenes();
+  size_t stride = aSVMs->size();
+  SVMTestScratch scratch;
+
+  if (mSinglePrecision && mUseDenseModels)
+  {
+    std::vector<float> buffer(mEMP.isMappedFloat() ? 0 : aCount * nGenes);
+    std::vector<const float*> rows(aCount);
+    for (size_t i = 0; i < aCount; i++)
+      rows[i] = mEMP.readArrayFloat(aArrays[i],
+                                    buffer.empty() ? NULL : &buffer[i * nGenes]);
+
+    for (size_t j = 0; j < stride; j++)
+      (*aSVMs)[j]->testOnRows(&rows[0], aCount, aResults + j, stride,
+                              scratch);
+    return;
+  }
 
-  mModel = svm_load_model(aFilename.c_str());
+  std::vector<double> buffer(mEMP.isMapped() ? 0 : aCount * nGenes);
+  std::vector<const double*> rows(aCount);
+  for (size_t i = 0; i < aCount; i++)
+    rows[i] = mEMP.readArray(aArrays[i],
+                             buffer.empty() ? NULL : &buffer[i * nGenes]);
 
-  assert(mModel);
+  std::vector<svm_node> nodes(maxRegulators + 1);
+
+  if (!mUseDenseModels)
+  {
+    for (size_t i = 0; i < aCount; i++)
+      for (size_t j = 0; j < stride; j++)
+        aResults[i * stride + j] = (*aSVMs)[j]->testOnRow(rows[i], &nodes[0]);
+    return;
+  }
+
+  for (size_t j = 0; j < stride; j++)
+    (*aSVMs)[j]->testOnRows(&rows[0], aCount, aResults + j, stride, scratch,
+                            &nodes[0]);
 }
 
 double
-SupportVectorMachine::testOnRow()
+GRNModel::compareDenseModels(const std::vector<uint32_t>& aArrays)
 {
-  // We just ignore the whole array if there are NaNs...
-  svm_node* p = mTestNodes;
-  uint32_t k = 1;
-  for (std::vector<uint32_t>::iterator j = mRegulatingGenes.begin();
-       j != mRegulatingGenes.end(); j++)
+  std::vector<SupportVectorMachine*> svms(mSVMs.begin(), mSVMs.end());
+  for (std::vector<SupportVectorMachine*>::iterator j = svms.begin();
+       j != svms.end();
+       j++)
+    if (!(*j)->hasLibSVMModel())
+      return std::numeric_limits<double>::infinity();
+
+  std::vector<double> buffer(mEMP.getNumGenes());
+  SVMTestScratch scratch;
+  double worst = 0.0;
+
+  for (std::vector<uint32_t>::const_iterator i = aArrays.begin();
+       i != aArrays.end();
+       i++)
   {
-    double v(mEMP.getDataPoint(*j));
-    if (!isfinite(v))
-      return std::numeric_limits<double>::quiet_NaN();
-    else
+    const double* row = mEMP.readArray(*i, &buffer[0]);
+
+    for (std::vector<SupportVectorMachine*>::iterator j = svms.begin();
+         j != svms.end();
+         j++)
     {
-      p->index = k++;
-      p->value = v;
-      p++;
+      std::vector<svm_node> nodes((*j)->getNumRegulators() + 1);
+      double exact = (*j)->testOnRow(row, &nodes[0]), dense;
+      (*j)->testOnRows(&row, 1, &dense, 1, scratch, &nodes[0]);
+
+      if (isfinite(exact) != isfinite(dense))
+        return std::numeric_limits<double>::infinity();
+      if (isfinite(exact))
+        worst = std::max(worst, fabs(dense - exact) / (1.0 + exact));
     }
   }
 
-  p->index = -1;
-
-  double answer = mEMP.getDataPoint(mRegulatedGene);
-  if (!isfinite(answer))
-    return std::numeric_limits<double>::quiet_NaN();
-
-  double x = (svm_predict(mModel, mTestNodes) - answer);
-  return x * x;
+  return worst;
 }
 
 GRNModel::GRNModel(const std::string& aModel,
                    ExpressionMatrixProcessor& aEMP,
                    uint32_t aGeneLimit)
-  : mEMP(aEMP)
+  : mEMP(aEMP), mUseDenseModels(true), mSinglePrecision(false),
+    mArchive(NULL)
+{
+  if (!loadCompiledModel(aModel, aGeneLimit))
+    parseModel(aModel, aGeneLimit);
+}
+
+void
+GRNModel::addSVM(const std::string& aRegulatedGene,
+                 const std::vector<uint32_t>& aRegulators)
+{
+  SupportVectorMachine* svm(new SupportVectorMachine(mEMP, aRegulatedGene,
+                                                     aRegulators.size()));
+  for (std::vector<uint32_t>::const_iterator i = aRegulators.begin();
+       i != aRegulators.end();
+       i++)
+    svm->addRegulatingGene(*i);
+
+  mSVMs.push_back(svm);
+}
+
+// Reads the number at aLine[aPos], moving aPos past it. Fails if there are
+// no digits there.
+static bool
+parseNumber(const std::string& aLine, size_t& aPos, uint32_t& aNumber)
+{
+  size_t start = aPos;
+  aNumber = 0;
+  while (aPos < aLine.size() && aLine[aPos] >= '0' && aLine[aPos] <= '9')
+    aNumber = aNumber * 10 + (aLine[aPos++] - '0');
+  return aPos != start;
+}
+
+static bool
+startsWith(const std::string& aLine, size_t aPos, const char* aText)
+{
+  return aLine.compare(aPos, strlen(aText), aText) == 0;
+}
+
+// The text format is VERTICES, then lines of "VERTEX <vertex> <gene>" up to
+// ENDVERTICES, and then lines of "EDGES <vertex> (<vertex> <vertex> ...)",
+// each giving a regulated gene and its regulators. Anything else is
+// skipped.
+void
+GRNModel::parseModel(const std::string& aModel, uint32_t aGeneLimit)
 {
   std::ifstream m(aModel.c_str());
 
@@ -361,66 +1685,222 @@ GRNModel::GRNModel(const std::string& aModel,
               << std::endl;
     return;
   }
-  
-  const static boost::regex vertexline("VERTEX ([0-9]+) (.*)");
 
+  // Each vertex's gene name, and its index in the matrix.
+  std::vector<std::string> names;
   while (m.good())
   {
     std::getline(m, l);
     if (l == "ENDVERTICES")
       break;
 
-    boost::smatch res;
-    if (!boost::regex_match(l, res, vertexline))
+    size_t p = 7;
+    uint32_t vno;
+    if (!startsWith(l, 0, "VERTEX ") || !parseNumber(l, p, vno) ||
+        p >= l.size() || l[p] != ' ')
       continue;
 
-    uint32_t vno = strtoul(res[1].str().c_str(), NULL, 10);
-    mHGNCByVertex[vno] = res[2];
+    if (vno >= names.size())
+      names.resize(vno + 1);
+    names[vno] = l.substr(p + 1);
   }
 
-  const static boost::regex edgeline("EDGES ([0-9]+) \\((.*)\\)");
+  std::vector<uint32_t> genes(names.size());
+  for (uint32_t v = 0; v < names.size(); v++)
+    genes[v] = names[v].empty() ? ExpressionMatrixProcessor::kNotFound :
+      mEMP.getIndexOfGene(names[v]);
 
+  uint32_t missingGenes = 0;
+  std::vector<uint32_t> regulators;
   while (m.good() && (unlimitedGenes || aGeneLimit-- > 0))
   {
     std::getline(m, l);
-    boost::smatch res;
-    if (!boost::regex_match(l, res, edgeline))
+
+    size_t p = 6;
+    uint32_t g;
+    if (!startsWith(l, 0, "EDGES ") || !parseNumber(l, p, g) ||
+        !startsWith(l, p, " (") || l[l.size() - 1] != ')')
     {
       aGeneLimit++;
       continue;
     }
 
-    uint32_t g(strtoul(res[1].str().c_str(), NULL, 10));
-    std::string targGene(mHGNCByVertex[g]);
-
-    typedef boost::tokenizer<boost::char_separator<char> > tokenizer;
-    boost::char_separator<char> sep(" ");
-    std::string rgl(res[2]);
-    tokenizer t(rgl, sep);
-    std::vector<uint32_t> regulators;
-    for (tokenizer::iterator i = t.begin(); i != t.end(); i++)
+    if (g >= names.size() || names[g].empty())
     {
-      std::string g(*i);
+      aGeneLimit++;
+      continue;
+    }
+    const std::string& targGene(names[g]);
 
-      regulators.push_back(aEMP.getIndexOfGene
-                           (mHGNCByVertex[strtoul(g.c_str(), NULL, 10)]));
+    // The regulators are separated by (any number of) spaces. As before,
+    // anything which isn't a number is taken to be vertex 0.
+    regulators.clear();
+    const char* r = l.c_str() + p + 2, * end = l.c_str() + l.size() - 1;
+    while (r < end)
+    {
+      if (*r == ' ')
+      {
+        r++;
+        continue;
+      }
+
+      uint32_t v = strtoul(r, NULL, 10);
+      while (r < end && *r != ' ')
+        r++;
+
+      uint32_t index = (v < genes.size()) ? genes[v] :
+        ExpressionMatrixProcessor::kNotFound;
+      if (index != ExpressionMatrixProcessor::kNotFound)
+        regulators.push_back(index);
+      else if (v < names.size() && !names[v].empty() &&
+               missingGenes++ < kReportedMisses)
+        std::cerr << "Regulator " << names[v] << " of " << targGene
+                  << " isn't in the matrix; leaving it out." << std::endl;
     }
-    
-    if (targGene == "")
+
+    if (genes[g] == ExpressionMatrixProcessor::kNotFound)
     {
+      if (missingGenes++ < kReportedMisses)
+        std::cerr << "Gene " << targGene << " isn't in the matrix; not "
+                  << "modelling it." << std::endl;
       aGeneLimit++;
       continue;
     }
 
-    SupportVectorMachine* svm(new SupportVectorMachine(aEMP, targGene,
-                                                       regulators.size()));
-    for (std::vector<uint32_t>::iterator i = regulators.begin();
-         i != regulators.end();
-         i++)
-      svm->addRegulatingGene(*i);
+    addSVM(targGene, regulators);
+  }
+
+  if (missingGenes > kReportedMisses)
+    std::cerr << "Left out " << missingGenes - kReportedMisses << " more "
+              << "genes which aren't in the matrix." << std::endl;
+}
+
+// Returns false if aModel isn't in the compiled format at all, so that it
+// can be parsed as text instead.
+bool
+GRNModel::loadCompiledModel(const std::string& aModel, uint32_t aGeneLimit)
+{
+  using namespace CompiledModelFormat;
+
+  FILE* f = fopen(aModel.c_str(), "r");
+  if (f == NULL)
+    return false;
+
+  Header h;
+  if (fread(&h, sizeof(h), 1, f) != 1 ||
+      memcmp(h.mMagic, kMagic, sizeof(kMagic)) != 0)
+  {
+    fclose(f);
+    return false;
+  }
+
+  uint32_t nGenes = mEMP.getNumGenes();
+  if (h.mVersion != kVersion || h.mnGenes != nGenes ||
+      h.mGeneListFingerprint != mEMP.getGeneListFingerprint())
+  {
+    std::cerr << aModel << " was compiled against a different matrix (or "
+              << "by a different version); re-run CompileGRNModel. Not "
+              << "loaded." << std::endl;
+    fclose(f);
+    return true;
+  }
+
+  // The counts decide how much is allocated, so they have to agree with the
+  // size of the file before anything is.
+  uint64_t expected = sizeof(h) + sizeof(uint32_t) *
+    (2 * static_cast<uint64_t>(h.mnTargets) + 1 + h.mnRegulators);
+  if (fs::file_size(aModel) != expected)
+  {
+    std::cerr << aModel << " is truncated or damaged. Not loaded."
+              << std::endl;
+    fclose(f);
+    return true;
+  }
 
-    mSVMs.push_back(svm);
+  std::vector<uint32_t> targets(h.mnTargets),
+    offsets(static_cast<size_t>(h.mnTargets) + 1), regulators(h.mnRegulators);
+  bool ok =
+    (targets.empty() ||
+     fread(&targets[0], sizeof(uint32_t), targets.size(), f) ==
+     targets.size()) &&
+    fread(&offsets[0], sizeof(uint32_t), offsets.size(), f) ==
+    offsets.size() &&
+    (regulators.empty() ||
+     fread(&regulators[0], sizeof(uint32_t), regulators.size(), f) ==
+     regulators.size()) &&
+    offsets[0] == 0 && offsets[h.mnTargets] == h.mnRegulators;
+  fclose(f);
+
+  for (uint32_t t = 0; ok && t < h.mnTargets; t++)
+    ok = (targets[t] < nGenes && offsets[t] <= offsets[t + 1]);
+  for (uint32_t r = 0; ok && r < h.mnRegulators; r++)
+    ok = (regulators[r] < nGenes);
+
+  if (!ok)
+  {
+    std::cerr << aModel << " is truncated or damaged. Not loaded."
+              << std::endl;
+    return true;
+  }
+
+  uint32_t n = h.mnTargets;
+  if (aGeneLimit != 0 && aGeneLimit < n)
+    n = aGeneLimit;
+
+  std::vector<uint32_t> svmRegulators;
+  for (uint32_t t = 0; t < n; t++)
+  {
+    svmRegulators.assign(regulators.begin() + offsets[t],
+                         regulators.begin() + offsets[t + 1]);
+    addSVM(mEMP.getGeneName(targets[t]), svmRegulators);
+  }
+
+  return true;
+}
+
+bool
+GRNModel::saveCompiledModel(const std::string& aFilename)
+{
+  using namespace CompiledModelFormat;
+
+  std::vector<uint32_t> targets, offsets(1, 0), regulators;
+  for (std::list<SupportVectorMachine*>::iterator i = mSVMs.begin();
+       i != mSVMs.end();
+       i++)
+  {
+    const std::vector<uint32_t>& r((*i)->getRegulatingGenes());
+    targets.push_back((*i)->getRegulatedGene());
+    regulators.insert(regulators.end(), r.begin(), r.end());
+    offsets.push_back(regulators.size());
   }
+
+  Header h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.mMagic, kMagic, sizeof(kMagic));
+  h.mVersion = kVersion;
+  h.mnGenes = mEMP.getNumGenes();
+  h.mnTargets = targets.size();
+  h.mnRegulators = regulators.size();
+  h.mGeneListFingerprint = mEMP.getGeneListFingerprint();
+
+  FILE* f = fopen(aFilename.c_str(), "w");
+  if (f == NULL)
+    return false;
+
+  bool ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+    (targets.empty() ||
+     fwrite(&targets[0], sizeof(uint32_t), targets.size(), f) ==
+     targets.size()) &&
+    fwrite(&offsets[0], sizeof(uint32_t), offsets.size(), f) ==
+    offsets.size() &&
+    (regulators.empty() ||
+     fwrite(&regulators[0], sizeof(uint32_t), regulators.size(), f) ==
+     regulators.size());
+
+  if (fclose(f) != 0)
+    ok = false;
+
+  return ok;
 }
 
 GRNModel::~GRNModel()
@@ -431,6 +1911,22 @@ GRNModel::~GRNModel()
        i++
       )
     delete *i;
+
+  if (mArchive)
+    delete mArchive;
+}
+
+void
+GRNModel::getModelledGenes(std::vector<uint32_t>& aGenes)
+{
+  aGenes.clear();
+  for (std::list<SupportVectorMachine*>::iterator i = mSVMs.begin();
+       i != mSVMs.end();
+       i++)
+    aGenes.push_back((*i)->getRegulatedGene());
+
+  std::sort(aGenes.begin(), aGenes.end());
+  aGenes.erase(std::unique(aGenes.begin(), aGenes.end()), aGenes.end());
 }
 
 void
@@ -462,3 +1958,45 @@ GRNModel::loadSVMs(const std::string& aFilename)
     (*i)->load(targ.string());
   }
 }
+
+bool
+GRNModel::saveSVMArchive(const std::string& aFilename)
+{
+  SVMArchiveWriter w;
+
+  for (std::list<SupportVectorMachine*>::iterator i = mSVMs.begin();
+       i != mSVMs.end();
+       i++)
+  {
+    const DenseRBFModel* m = (*i)->getDenseModel();
+    if (m == NULL)
+    {
+      std::cerr << "No RBF model for " << (*i)->getRegulatedGeneName()
+                << "; leaving it out of the archive." << std::endl;
+      continue;
+    }
+    w.add((*i)->getRegulatedGeneName(), *m);
+  }
+
+  return w.write(aFilename);
+}
+
+bool
+GRNModel::loadSVMArchive(const std::string& aFilename)
+{
+  if (mArchive)
+    delete mArchive;
+  mArchive = new SVMArchive(aFilename);
+
+  if (!mArchive->isValid())
+    return false;
+
+  for (std::list<SupportVectorMachine*>::iterator i = mSVMs.begin();
+       i != mSVMs.end();
+       i++)
+    if (!(*i)->loadFromArchive(*mArchive))
+      std::cerr << "No model for " << (*i)->getRegulatedGeneName()
+                << " in " << aFilename << std::endl;
+
+  return true;
+}
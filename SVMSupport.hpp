@@ -21,28 +21,292 @@
 #include <map>
 #include <vector>
 #include <list>
+#include <algorithm>
 #include <svm.h>
 #include <fstream>
+#include <iostream>
 #include <math.h>
+#include "ThreadPool.hpp"
+#include "DenseRBFModel.hpp"
+#include "SVMArchive.hpp"
+#include "CompressedMatrix.hpp"
+#include "NameIndex.hpp"
 
 class ExpressionMatrixProcessor
 {
 public:
-  ExpressionMatrixProcessor(const std::string& aMatrixDir);
+  // How the data file is accessed. The mapped modes only differ in the hint
+  // given to the kernel about the order arrays will be visited in.
+  enum AccessMode
+  {
+    kStreamedAccess,
+    kMappedSequentialAccess,
+    kMappedRandomAccess
+  };
+
+  // With aSinglePrecision, the float copy of the data (data32, written by
+  // ConvertMatrix) is read instead of data, if there is one. If there is no
+  // data file, the compressed copy (dataz, also from ConvertMatrix) is used.
+  ExpressionMatrixProcessor(const std::string& aMatrixDir,
+                            AccessMode aMode = kMappedRandomAccess,
+                            bool aSinglePrecision = false);
   ~ExpressionMatrixProcessor();
 
-  uint32_t getIndexOfGene(const std::string& aGene);
-  uint32_t getIndexOfArray(const std::string& aArray);
+  // Returned by getIndexOfGene() and getIndexOfArray() for names which
+  // aren't in the matrix.
+  static const uint32_t kNotFound = NameIndex::kNotFound;
+
+  uint32_t getIndexOfGene(const std::string& aGene) const
+  {
+    return mGeneIndices.find(aGene);
+  }
+  uint32_t getIndexOfArray(const std::string& aArray) const
+  {
+    return mArrayIndices.find(aArray);
+  }
+  std::string getGeneName(uint32_t aGene) const
+  {
+    return mGeneIndices.getName(aGene);
+  }
+  uint64_t getGeneListFingerprint() const
+  {
+    return mGeneIndices.getFingerprint();
+  }
+  std::string getArrayName(uint32_t aArray) const
+  {
+    return mArrayIndices.getName(aArray);
+  }
+  uint64_t getArrayListFingerprint() const
+  {
+    return mArrayIndices.getFingerprint();
+  }
+  // Reads an array set saved in ArraySetFormat into aArrays, setting aBinary
+  // to whether aFilename is in that format at all. Returns false if it isn't,
+  // or if the set was made for a different arrays list or is truncated.
+  bool loadBinaryArraySet(const std::string& aFilename,
+                          std::vector<uint32_t>& aArrays, bool& aBinary) const;
   void setArray(uint32_t aArray);
-  double getDataPoint(uint32_t aGene);
+  void setAccessMode(AccessMode aMode);
+
+  // Starts reading the rows of aArrays, in order, on a background thread,
+  // keeping up to getReadAheadRows() of them ready ahead of setArray(). While
+  // it runs, setArray() on the next array in the sequence hands over the row
+  // already read, and any other array is read as usual. Only the thread
+  // calling setArray() may start or stop reading ahead.
+  void startReadAhead(const std::vector<uint32_t>& aArrays);
+  void stopReadAhead();
+  // 0 turns reading ahead off.
+  void setReadAheadRows(uint32_t aRows) { mReadAheadRows = aRows; }
+  uint32_t getReadAheadRows() const { return mReadAheadRows; }
+  double getDataPoint(uint32_t aGene)
+  {
+    return mRow[aGene];
+  }
+  const double* getRow() const { return mRow; }
+
+  // Gets an array's row without changing the current array, so that several
+  // threads can each look at their own arrays. The row is read into aBuffer
+  // (mnGenes long) unless isMapped(), in which case aBuffer may be NULL.
+  const double* readArray(uint32_t aArray, double* aBuffer);
+  // The same in single precision; aBuffer may be NULL if isMappedFloat().
+  const float* readArrayFloat(uint32_t aArray, float* aBuffer);
   uint32_t getNumGenes() const { return mnGenes; }
   uint32_t getNumArrays() const { return mnArrays; }
+  // Whether rows can be used straight out of the mapped data file, in double
+  // or single precision respectively.
+  bool isMapped() const { return mMapping != NULL && !mSinglePrecision; }
+  bool isMappedFloat() const { return mMapping != NULL && mSinglePrecision; }
+  // Says which arrays are about to be read, in order, so that compressed
+  // data can be decompressed ahead of time, and other data read ahead as
+  // willNeedArrays() does. Only one thread may use this at a time.
+  void prefetchArrays(const std::vector<uint32_t>& aArrays);
+  // Asks the kernel to start reading in the rows of aArrays. Neighbouring
+  // arrays are asked for together, so arrays in increasing order (e.g. an
+  // ArraySet) are read ahead as one forward scan. Can be used from any
+  // thread.
+  void willNeedArrays(const uint32_t* aArrays, size_t aCount);
+
+  // The gene-major copy of the data (genedata, written by TransposeMatrix)
+  // holds each gene's values across every array contiguously. The column
+  // returned is only valid until the next call.
+  bool hasGeneMajorData() const
+  {
+    return mGeneMapping != NULL || mGeneDataFile != NULL;
+  }
+  const double* getGeneColumn(uint32_t aGene);
 
 private:
-  std::map<std::string, uint32_t> mArrayIndices, mGeneIndices;
+  // Saved as arrays.index and genes.index in the matrix directory.
+  NameIndex mArrayIndices, mGeneIndices;
   uint32_t mnGenes, mnArrays;
   FILE* mDataFile;
-  double* mRow;
+  // mRow points either into mMapping or at mRowBuffer.
+  const double* mRow;
+  double* mRowBuffer, * mMissingRow;
+  float* mMissingRowFloat;
+  void* mMapping;
+  size_t mMappingSize;
+  AccessMode mAccessMode;
+  // Whether the data file holds floats rather than doubles.
+  bool mSinglePrecision;
+  CompressedMatrix* mCompressed;
+
+  const void* readRawArray(uint32_t aArray, void* aBuffer);
+
+  static const uint32_t kDefaultReadAheadRows = 4;
+
+  // Position p of mAheadSequence is read into mAheadBuffers[p % slots],
+  // with one slot more than mReadAheadRows so that the row setArray() last
+  // handed over is never overwritten. The positions before mAheadRead have
+  // been read, and those before mAheadNext handed over.
+  uint32_t mReadAheadRows;
+  std::vector<uint32_t> mAheadSequence;
+  std::vector<std::vector<double> > mAheadBuffers;
+  std::vector<const double*> mAheadRows;
+  size_t mAheadRead, mAheadNext;
+  bool mAheadStop;
+  boost::thread* mAheadThread;
+  boost::mutex mAheadMutex;
+  boost::condition_variable mAheadChanged;
+
+  void readAheadLoop();
+
+  FILE* mGeneDataFile;
+  double* mColumnBuffer;
+  void* mGeneMapping;
+  size_t mGeneMappingSize;
+
+  void* mapFile(const std::string& aFile, size_t& aSize);
+  void openGeneMajorData(const std::string& aFile);
+};
+
+// A set of arrays in a matrix, held as their indices in increasing order,
+// with none repeated. Names are only looked up once, when the set is made,
+// however many times it is used afterwards, and reading the arrays in order
+// is a forward scan of the data. A set read from a list also remembers the
+// order the arrays were listed in, for output which has to follow it.
+class ArraySet
+{
+public:
+  typedef std::vector<uint32_t>::const_iterator const_iterator;
+
+  ArraySet() {}
+  // aArrays may be in any order, and have repeats.
+  explicit ArraySet(const std::vector<uint32_t>& aArrays);
+  // Leaves out (with a warning) any names which aren't in the matrix.
+  template<class Container>
+  ArraySet(const ExpressionMatrixProcessor& aEMP, const Container& aNames)
+  {
+    lookUp(aEMP, aNames, mListed);
+    normalise();
+  }
+
+  // Reads a list of array names, one to a line, or a binary array set from
+  // SampleArrays. Returns false if the file can't be read, or is a binary
+  // set which can't be used with this matrix.
+  bool load(const ExpressionMatrixProcessor& aEMP,
+            const std::string& aFilename);
+
+  ArraySet intersect(const ArraySet& aOther) const;
+  ArraySet subtract(const ArraySet& aOther) const;
+  // The aCount arrays starting at the aFirst'th.
+  ArraySet slice(size_t aFirst, size_t aCount) const;
+  // Puts the i'th array into aSets[aParts[i]]; aParts is as long as the set.
+  void split(const std::vector<uint32_t>& aParts,
+             std::vector<ArraySet>& aSets) const;
+
+  size_t size() const { return mArrays.size(); }
+  bool empty() const { return mArrays.empty(); }
+  const_iterator begin() const { return mArrays.begin(); }
+  const_iterator end() const { return mArrays.end(); }
+  uint32_t operator[](size_t aIndex) const { return mArrays[aIndex]; }
+  const std::vector<uint32_t>& getIndices() const { return mArrays; }
+  // The arrays in the order they were listed, repeats included. Sets made
+  // by intersect(), subtract(), slice() or split() weren't listed, so this
+  // is the same as getIndices() for them.
+  const std::vector<uint32_t>& getListed() const
+  {
+    return mListed.empty() ? mArrays : mListed;
+  }
+
+  // Looks up each name, in the order given, leaving out (with a warning)
+  // those which aren't in the matrix.
+  template<class Container>
+  static void
+  lookUp(const ExpressionMatrixProcessor& aEMP, const Container& aNames,
+         std::vector<uint32_t>& aArrays)
+  {
+    uint32_t missing = 0;
+    aArrays.clear();
+    aArrays.reserve(aNames.size());
+    for (typename Container::const_iterator i = aNames.begin();
+         i != aNames.end();
+         i++)
+    {
+      uint32_t a = aEMP.getIndexOfArray(*i);
+      if (a != ExpressionMatrixProcessor::kNotFound)
+        aArrays.push_back(a);
+      else if (missing++ < kReportedMisses)
+        std::cerr << "Array " << *i << " isn't in the matrix; skipping it."
+                  << std::endl;
+    }
+
+    if (missing > kReportedMisses)
+      std::cerr << "Skipped " << missing - kReportedMisses << " more arrays "
+                << "which aren't in the matrix." << std::endl;
+  }
+
+private:
+  std::vector<uint32_t> mArrays, mListed;
+
+  // How many names which aren't in the matrix are reported one by one.
+  static const uint32_t kReportedMisses = 10;
+
+  // Sets mArrays to the arrays in mListed, in order with no repeats.
+  void normalise();
+};
+
+// The training values of every gene any SVM in a model uses, whether as a
+// regulator or as the regulated gene, each stored once however many SVMs use
+// it. Column c holds one value for each training array, and bit a of its
+// mask is set when the value for array a is finite.
+class RegulatorMatrix
+{
+public:
+  RegulatorMatrix();
+
+  // Returns the column for aGene, adding one if it isn't there yet. All
+  // columns must be added before load().
+  uint32_t addGene(uint32_t aGene);
+  void load(ExpressionMatrixProcessor& aEMP,
+            const std::vector<uint32_t>& aArrays);
+
+  uint32_t getNumArrays() const { return mnArrays; }
+  uint32_t getNumColumns() const { return mGenes.size(); }
+  uint32_t getMaskWords() const { return mMaskWords; }
+  const double* getColumn(uint32_t aColumn) const
+  {
+    return &mValues[static_cast<size_t>(aColumn) * mnArrays];
+  }
+  const uint64_t* getMask(uint32_t aColumn) const
+  {
+    return &mMask[static_cast<size_t>(aColumn) * mMaskWords];
+  }
+
+private:
+  std::map<uint32_t, uint32_t> mColumnsByGene;
+  std::vector<uint32_t> mGenes;
+  uint32_t mnArrays, mMaskWords;
+  std::vector<double> mValues;
+  std::vector<uint64_t> mMask;
+};
+
+// Per-thread working space for SupportVectorMachine::testOnRows.
+struct SVMTestScratch
+{
+  std::vector<double> mFeatures, mPredictions, mAnswers;
+  std::vector<float> mFloatFeatures;
+  std::vector<uint32_t> mRows;
 };
 
 class SupportVectorMachine
@@ -55,13 +319,67 @@ public:
 
   void addRegulatingGene(uint32_t aRegulatingGene);
 
-  void setupProblem(uint32_t aSize);
-  void loadTrainingRow();
+  // Adds the genes this SVM needs to aMatrix, and then, once it is loaded,
+  // finds the training arrays where none of them are missing. The matrix
+  // must outlive any training.
+  void useTrainingData(RegulatorMatrix& aMatrix);
+  void findUsableArrays();
+
+  // Works out the squared distances between every pair of usable training
+  // arrays, which don't depend on any of the parameters, so that train() can
+  // give libsvm a precomputed kernel instead of having it work each one out
+  // again for every gamma. getDistanceBytes() is how much memory that takes.
+  void precomputeDistances();
+  uint64_t getDistanceBytes()
+  {
+    uint64_t l = mUsableArrays.size();
+    return l * (l + 1) / 2 * sizeof(double);
+  }
+  // The most memory the precomputed kernel handed to libsvm takes while
+  // train() runs, on top of the distances.
+  uint64_t getPrecomputedProblemBytes()
+  {
+    uint64_t l = mUsableArrays.size();
+    return l * (l + 2) * sizeof(svm_node) +
+      l * (sizeof(double) + sizeof(svm_node*));
+  }
+
+  // The training rows (numbered among the usable training arrays) which
+  // ended up as support vectors last time this was trained.
+  const std::vector<uint32_t>& getSupportRows() { return mSupportRows; }
+  // Support rows from training with nearby parameters, to start the next
+  // train() from.
+  void setWarmStart(const std::vector<uint32_t>& aSupportRows);
+
+  // The most memory, in megabytes, libsvm may use to cache kernel values.
+  void setCacheLimit(double aMegabytes) { mCacheLimit = aMegabytes; }
+  // Trains on only the first aRows usable training arrays (all of them if
+  // aRows is 0), e.g. to get a cheap, rough idea of how good the parameters
+  // are. Precomputed distances and support rows stay valid either way.
+  void setTrainingRowLimit(uint32_t aRows) { mRowLimit = aRows; }
 
   void train();
   double testOnRow();
+  // As above, but on any row, using aNodes (getNumRegulators() + 1 long) as
+  // scratch space, so it can be run from several threads at once.
+  double testOnRow(const double* aRow, svm_node* aNodes);
+  // Tests aCount rows at once through the dense copy of the model, putting
+  // the result for row r in aResults[r * aResultStride].
+  void testOnRows(const double* const* aRows, uint32_t aCount,
+                  double* aResults, size_t aResultStride,
+                  SVMTestScratch& aScratch, svm_node* aNodes);
+  // The same, in single precision. prepareSinglePrecision() must have been
+  // called since the model was last trained or loaded.
+  void testOnRows(const float* const* aRows, uint32_t aCount,
+                  double* aResults, size_t aResultStride,
+                  SVMTestScratch& aScratch);
+  void prepareSinglePrecision();
   void save(const std::string& aFilename);
   void load(const std::string& aFilename);
+  bool loadFromArchive(const SVMArchive& aArchive);
+  const DenseRBFModel* getDenseModel() { return mDenseModel; }
+  // False if only the dense copy was loaded, e.g. from an archive.
+  bool hasLibSVMModel() { return mModel != NULL; }
 
   const std::string& getRegulatedGeneName()
   {
@@ -73,6 +391,24 @@ public:
     return mRegulatedGene;
   }
 
+  uint32_t getNumRegulators()
+  {
+    return mNumRegulators;
+  }
+
+  const std::vector<uint32_t>& getRegulatingGenes()
+  {
+    return mRegulatingGenes;
+  }
+
+  // A rough measure of how long train() will take, for scheduling.
+  uint64_t getTrainingCost()
+  {
+    if (mNumRegulators == 0)
+      return 0;
+    return static_cast<uint64_t>(mNumRegulators) * mUsableArrays.size();
+  }
+
   void
   setParameters(double aGamma, double aC, double aNu)
   {
@@ -86,18 +422,65 @@ private:
   std::vector<uint32_t> mRegulatingGenes;
   uint32_t mRegulatedGene, mNumRegulators;
   struct svm_model* mModel;
-  struct svm_problem mProblem;
   struct svm_parameter mParameter;
-  double mAverage, mSum, mGamma, mC, mNu;
-  uint32_t mNumFinite;
-  double * mYp;
-  svm_node ** mXp, *mTestNodes;
+  double mAverage, mGamma, mC, mNu;
+  svm_node *mTestNodes;
   std::string mRegulatedGeneName;
+  DenseRBFModel* mDenseModel;
+
+  const RegulatorMatrix* mTrainingData;
+  // The training data columns of the regulating genes, in order, and then
+  // of the regulated gene.
+  std::vector<uint32_t> mColumns;
+  std::vector<uint32_t> mUsableArrays;
+  // The squared distance between usable arrays i >= j is at
+  // [i * (i + 1) / 2 + j]. Empty unless precomputeDistances() was called.
+  std::vector<double> mDistances;
+  double mCacheLimit;
+  std::vector<uint32_t> mSupportRows, mWarmStart;
+  uint32_t mRowLimit;
+
+  static const uint32_t kWarmStartRounds = 4;
+
+  bool trainFromWarmStart();
+  uint32_t getNumTrainingRows();
+  void trainOnRows(const std::vector<uint32_t>& aRows, double aNu);
+  void buildProblem(const std::vector<uint32_t>& aRows,
+                    struct svm_problem& aProblem, svm_node*& aNodes);
+  void buildPrecomputedProblem(const std::vector<uint32_t>& aRows,
+                               struct svm_problem& aProblem,
+                               svm_node*& aNodes);
+  void buildDenseModel();
+  void compactSupportVectors(const std::vector<uint32_t>& aRows,
+                             const svm_node* aNodes);
 };
 
+// A model compiled by CompileGRNModel against a particular genes list, laid
+// out (in native byte order) as:
+//   Header, at the start of the file.
+//   uint32_t targets[mnTargets], the regulated gene of each SVM.
+//   uint32_t offsets[mnTargets + 1]; SVM t's regulators are
+//   regulators[offsets[t]] up to regulators[offsets[t + 1]].
+//   uint32_t regulators[mnRegulators].
+// Genes are numbered as in the matrix directory's genes list.
+namespace CompiledModelFormat
+{
+  static const char kMagic[8] = { 'S', 'V', 'M', 'G', 'R', 'N', 'C', '\0' };
+  static const uint32_t kVersion = 1;
+
+  struct Header
+  {
+    char mMagic[8];
+    uint32_t mVersion, mnGenes, mnTargets, mnRegulators;
+    uint64_t mGeneListFingerprint;
+  };
+}
+
 class GRNModel
 {
 public:
+  // aModel is either the VERTICES/EDGES text format, or a model compiled
+  // against aEMP's genes by CompileGRNModel.
   GRNModel(const std::string& aModel,
            ExpressionMatrixProcessor& aEMP,
            uint32_t aGeneLimit = 0);
@@ -105,25 +488,30 @@ public:
 
   template<class Container> void loadSVMTrainingData(const Container& aTrainingArrays)
   {
-    uint32_t nTraining(aTrainingArrays.size());
+    std::vector<uint32_t> arrays;
+    getArrayIndices(aTrainingArrays, arrays);
+    loadSVMTrainingData(arrays);
+  }
 
-    for (std::list<SupportVectorMachine*>::iterator i = mSVMs.begin();
-         i != mSVMs.end();
-         i++)
-      (*i)->setupProblem(nTraining);
+  void loadSVMTrainingData(const std::vector<uint32_t>& aArrays);
 
-    for (typename Container::const_iterator i = aTrainingArrays.begin();
-         i != aTrainingArrays.end();
-         i++)
-    {
-      mEMP.setArray(mEMP.getIndexOfArray(*i));
-      
-      for (std::list<SupportVectorMachine*>::iterator j = mSVMs.begin();
-           j != mSVMs.end();
-           j++)
-        (*j)->loadTrainingRow();
-    }
-  }
+  // Precomputes the training distances for as many SVMs as fit in
+  // aMaxBytes, for when the SVMs will be retrained many times. The budget
+  // also has to hold the kernel each of aTrainers SVMs training at once
+  // hands to libsvm; the SVMs left out train on the regulator values.
+  void precomputeDistances(uint64_t aMaxBytes, uint32_t aTrainers = 1);
+
+  // Appends the support rows of every SVM to aRows, and starts each SVM's
+  // next train() from the rows in a list written that way, consuming them
+  // from aRows.
+  void getSupportRows(std::vector<uint32_t>& aRows);
+  void setWarmStart(const uint32_t*& aRows, const uint32_t* aEnd);
+
+  // See SupportVectorMachine::setTrainingRowLimit.
+  void setTrainingRowLimit(uint32_t aRows);
+  // Throws away all but the first aCount SVMs, for when only some of the
+  // genes are wanted (e.g. in a throwaway copy of the model).
+  void truncateSVMs(uint32_t aCount);
 
   void setSVMParameters(double aGamma, double aC, double aNu)
   {
@@ -133,25 +521,22 @@ public:
       (*i)->setParameters(aGamma, aC, aNu);
   }
 
-  void trainSVMs()
-  {
-    for (std::list<SupportVectorMachine*>::iterator i = mSVMs.begin();
-         i != mSVMs.end();
-         i++)
-      (*i)->train();
-  }
-
-  void trainAndSaveSVMs(const std::string& aSVMDir, bool aDontReplace = false);
+  void trainSVMs(uint32_t aNumThreads = 1);
+  void trainAndSaveSVMs(const std::string& aSVMDir, bool aDontReplace = false,
+                        uint32_t aNumThreads = 1);
 
   template<class Container> double testSVMs(const Container& aTestingArrays)
   {
     double testScore = 0.0;
+    std::vector<uint32_t> arrays;
+    getArrayIndices(aTestingArrays, arrays);
 
-    for (typename Container::const_iterator i = aTestingArrays.begin();
-         i != aTestingArrays.end();
+    mEMP.startReadAhead(arrays);
+    for (std::vector<uint32_t>::const_iterator i = arrays.begin();
+         i != arrays.end();
          i++)
     {
-      mEMP.setArray(mEMP.getIndexOfArray(*i));
+      mEMP.setArray(*i);
       
       for (std::list<SupportVectorMachine*>::iterator j = mSVMs.begin();
            j != mSVMs.end();
@@ -162,6 +547,7 @@ public:
           testScore += r;
       }
     }
+    mEMP.stopReadAhead();
 
     return testScore;
   }
@@ -170,33 +556,106 @@ public:
   void testSVMs(const Container& aTestingArrays,
                 Listener& aResults)
   {
-    for (typename Container::const_iterator i = aTestingArrays.begin();
-         i != aTestingArrays.end();
-         i++)
-    {
-      uint32_t idx = mEMP.getIndexOfArray(*i);
-      mEMP.setArray(idx);
-      aResults.startRow(idx);
+    testSVMs(aTestingArrays, aResults, 1);
+  }
 
-      double arraySum = 0.0;
-      uint32_t arrayCount = 0;
+  // Tests with the arrays spread across aNumThreads threads. The results are
+  // passed to the listener one array at a time, in the order given and
+  // including repeats, however many threads are used. Each batch is read
+  // in matrix order, with each array only tested once.
+  template<class Container, class Listener>
+  void testSVMs(const Container& aTestingArrays,
+                Listener& aResults,
+                uint32_t aNumThreads)
+  {
+    std::vector<uint32_t> arrays;
+    getArrayIndices(aTestingArrays, arrays);
 
-      for (std::list<SupportVectorMachine*>::iterator j = mSVMs.begin();
-           j != mSVMs.end();
-           j++)
-        aResults.result((*j)->getRegulatedGene(),
-                        (*j)->testOnRow());
+    // Only hold the results for a batch of arrays at a time.
+    size_t batch = kTestBatchResults / (mSVMs.size() + 1);
+    if (batch < aNumThreads)
+      batch = aNumThreads;
+
+    std::vector<double> results;
+    std::vector<uint32_t> reads;
+    for (size_t first = 0; first < arrays.size(); first += batch)
+    {
+      size_t n = std::min(batch, arrays.size() - first);
+      reads.assign(arrays.begin() + first, arrays.begin() + first + n);
+      std::sort(reads.begin(), reads.end());
+      reads.erase(std::unique(reads.begin(), reads.end()), reads.end());
+      mEMP.willNeedArrays(&reads[0], reads.size());
+      testArrayBatch(&reads[0], reads.size(), results, aNumThreads);
+
+      for (size_t i = first; i < first + n; i++)
+      {
+        std::vector<double>::iterator r = results.begin() + mSVMs.size() *
+          (std::lower_bound(reads.begin(), reads.end(), arrays[i]) -
+           reads.begin());
+        aResults.startRow(arrays[i]);
+
+        for (std::list<SupportVectorMachine*>::iterator j = mSVMs.begin();
+             j != mSVMs.end();
+             j++)
+          aResults.result((*j)->getRegulatedGene(), *r++);
 
-      aResults.endRow(idx);
+        aResults.endRow(arrays[i]);
+      }
     }
   }
 
+  // Writes the model out in the compiled format.
+  bool saveCompiledModel(const std::string& aFilename);
+
+  // The genes which have an SVM, in increasing order.
+  void getModelledGenes(std::vector<uint32_t>& aGenes);
+
+  // Whether testing goes through the dense models (the default), rather than
+  // asking libsvm for one prediction at a time.
+  void setDenseModels(bool aUseDense) { mUseDenseModels = aUseDense; }
+  // Whether testing reads the arrays, and works out the dense models, in
+  // single precision. Must be set again after loading or training.
+  void setSinglePrecision(bool aSingle);
+
+  // Returns the largest difference between the dense and libsvm predictions
+  // on the given arrays, relative to the size of the squared error, or
+  // infinity if any SVM has no libsvm model to compare against.
+  template<class Container>
+  double compareDenseModels(const Container& aTestingArrays)
+  {
+    std::vector<uint32_t> arrays;
+    getArrayIndices(aTestingArrays, arrays);
+    return compareDenseModels(arrays);
+  }
+
+  double compareDenseModels(const std::vector<uint32_t>& aArrays);
+
   void saveSVMs(const std::string& aSVMDir);
   void loadSVMs(const std::string& aSVMDir);
-
-  template<class Container> void loadArraySet(const std::string& aFilename,
+  bool saveSVMArchive(const std::string& aFilename);
+  // The archive is kept mapped, and each model is only read in when it is
+  // first used.
+  bool loadSVMArchive(const std::string& aFilename);
+
+  // aFilename lists array names one to a line, or is a binary array set
+  // from SampleArrays. Returns false if it is a binary set which can't be
+  // used with this matrix.
+  template<class Container> bool loadArraySet(const std::string& aFilename,
                                               Container& aArrays)
   {
+    std::vector<uint32_t> indices;
+    bool binary;
+    if (mEMP.loadBinaryArraySet(aFilename, indices, binary))
+    {
+      for (std::vector<uint32_t>::iterator i = indices.begin();
+           i != indices.end();
+           i++)
+        aArrays.push_back(mEMP.getArrayName(*i));
+      return true;
+    }
+    if (binary)
+      return false;
+
     std::ifstream s(aFilename.c_str());
     
     while (s.good())
@@ -207,10 +666,51 @@ public:
       if (l != "")
         aArrays.push_back(l);
     }
+    return true;
   }
 
 private:
   ExpressionMatrixProcessor& mEMP;
-  std::map<uint32_t, std::string> mHGNCByVertex;
   std::list<SupportVectorMachine*> mSVMs;
+  bool mUseDenseModels, mSinglePrecision;
+  SVMArchive* mArchive;
+  RegulatorMatrix mTrainingData;
+
+  static const size_t kTestBatchResults = 1 << 23;
+  static const size_t kTestShardArrays = 32;
+  // How many genes which aren't in the matrix are reported one by one.
+  static const uint32_t kReportedMisses = 10;
+
+  // Looks up each array, leaving out (with a warning) those which aren't in
+  // the matrix. An ArraySet has already been looked up.
+  template<class Container>
+  void getArrayIndices(const Container& aNames, std::vector<uint32_t>& aArrays)
+  {
+    ArraySet::lookUp(mEMP, aNames, aArrays);
+  }
+
+  void getArrayIndices(const ArraySet& aArrays, std::vector<uint32_t>& aIndices)
+  {
+    aIndices = aArrays.getIndices();
+  }
+
+  void getArrayIndices(const std::vector<uint32_t>& aArrays,
+                       std::vector<uint32_t>& aIndices)
+  {
+    aIndices = aArrays;
+  }
+
+  bool loadCompiledModel(const std::string& aModel, uint32_t aGeneLimit);
+  void parseModel(const std::string& aModel, uint32_t aGeneLimit);
+  void addSVM(const std::string& aRegulatedGene,
+              const std::vector<uint32_t>& aRegulators);
+  void getSVMsByTrainingCost(std::vector<SupportVectorMachine*>& aSVMs);
+  void setCacheLimits(uint32_t aNumThreads);
+  void testArrayBatch(const uint32_t* aArrays, size_t aCount,
+                      std::vector<double>& aResults, uint32_t aNumThreads);
+  void testArrayShard(const std::vector<SupportVectorMachine*>* aSVMs,
+                      const uint32_t* aArrays, size_t aCount,
+                      double* aResults);
+  void trainAndSaveSVM(SupportVectorMachine* aSVM, const std::string& aSVMDir,
+                       bool aDontReplace);
 };
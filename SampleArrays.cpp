@@ -0,0 +1,329 @@
+/*
+    Sample arrays from a matrix directory into training and testing sets.
+    Copyright (C) 2008-2009  Andrew Miller
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <boost/program_options.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/random_number_generator.hpp>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <time.h>
+#include "NameIndex.hpp"
+
+namespace po = boost::program_options;
+namespace fs = boost::filesystem;
+
+// Calling it with n gives a number from 0 to n - 1.
+typedef boost::random_number_generator<boost::mt19937, uint32_t>
+  RandomNumbers;
+
+// Sets aMarks[a] to aValue for every array named in aFile, returning how
+// many names weren't in the matrix.
+static uint32_t
+mark_arrays(const NameIndex& aArrays, const std::string& aFile,
+            std::vector<char>& aMarks, char aValue)
+{
+  uint32_t missing = 0;
+  std::ifstream f(aFile.c_str());
+  while (f.good())
+  {
+    std::string l;
+    std::getline(f, l);
+    if (l == "")
+      continue;
+
+    uint32_t a = aArrays.find(l);
+    if (a == NameIndex::kNotFound)
+      missing++;
+    else
+      aMarks[a] = aValue;
+  }
+  return missing;
+}
+
+// Reads "array<tab>class" lines, giving each array the number of its class
+// in aClasses. Arrays which aren't listed get class 0.
+static uint32_t
+read_strata(const NameIndex& aArrays, const std::string& aFile,
+            std::vector<uint32_t>& aClasses)
+{
+  std::map<std::string, uint32_t> numbers;
+  uint32_t missing = 0;
+  std::ifstream f(aFile.c_str());
+  while (f.good())
+  {
+    std::string l;
+    std::getline(f, l);
+    size_t tab = l.find('\t');
+    if (tab == std::string::npos)
+      continue;
+
+    uint32_t a = aArrays.find(l.substr(0, tab));
+    if (a == NameIndex::kNotFound)
+    {
+      missing++;
+      continue;
+    }
+
+    std::string c(l.substr(tab + 1));
+    std::map<std::string, uint32_t>::iterator n = numbers.find(c);
+    if (n == numbers.end())
+      n = numbers.insert(std::pair<std::string, uint32_t>
+                         (c, numbers.size() + 1)).first;
+    aClasses[a] = n->second;
+  }
+  return missing;
+}
+
+// Moves aCount arrays picked at random without replacement to the front of
+// aPool (a partial Fisher-Yates shuffle).
+static void
+sample(std::vector<uint32_t>& aPool, uint32_t aCount, RandomNumbers& aRandom)
+{
+  for (uint32_t i = 0; i < aCount; i++)
+    std::swap(aPool[i], aPool[i + aRandom(aPool.size() - i)]);
+}
+
+// Writes the arrays aMarks has aValue for, in matrix order.
+static bool
+write_set(const NameIndex& aArrays, const std::vector<char>& aMarks,
+          char aValue, const std::string& aFile, bool aBinary)
+{
+  std::vector<uint32_t> arrays;
+  for (uint32_t a = 0; a < aMarks.size(); a++)
+    if (aMarks[a] == aValue)
+      arrays.push_back(a);
+
+  FILE* f = (aFile == "") ? stdout : fopen(aFile.c_str(), "w");
+  if (f == NULL)
+  {
+    std::cerr << "Couldn't write " << aFile << std::endl;
+    return false;
+  }
+
+  bool ok = true;
+  if (aBinary)
+  {
+    using namespace ArraySetFormat;
+
+    Header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.mMagic, kMagic, sizeof(kMagic));
+    h.mVersion = kVersion;
+    h.mnArrays = arrays.size();
+    h.mArrayListFingerprint = aArrays.getFingerprint();
+    ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+      (arrays.empty() ||
+       fwrite(&arrays[0], sizeof(uint32_t), arrays.size(), f) ==
+       arrays.size());
+  }
+  else
+  {
+    for (uint32_t i = 0; ok && i < arrays.size(); i++)
+    {
+      std::string name(aArrays.getName(arrays[i]));
+      ok = fprintf(f, "%s\n", name.c_str()) >= 0;
+    }
+  }
+
+  if (f == stdout)
+    ok = (fflush(f) == 0) && ok;
+  else if (fclose(f) != 0)
+    ok = false;
+  if (!ok)
+    std::cerr << "Couldn't write " << aFile << std::endl;
+  return ok;
+}
+
+int
+main(int argc, char** argv)
+{
+  po::options_description desc;
+  std::string matrixdir, strata, output, format("text");
+  std::vector<std::string> includes, excludes;
+  uint32_t numSamples = 0, repeats = 1, seed = time(NULL);
+
+  desc.add_options()
+    ("matrixdir", po::value<std::string>(&matrixdir),
+     "The directory set up by SOFT2Matrix")
+    ("num-samples,n", po::value<uint32_t>(&numSamples),
+     "The number of arrays to sample (for the testing set)")
+    ("include,i", po::value<std::vector<std::string> >(&includes),
+     "A file of array names to sample from, instead of every array in the "
+     "matrix (may be given more than once)")
+    ("exclude,x", po::value<std::vector<std::string> >(&excludes),
+     "A file of array names to leave out (may be given more than once)")
+    ("stratify", po::value<std::string>(&strata),
+     "A file of array names and classes, separated by a tab; each class is "
+     "sampled in proportion to its size (optional)")
+    ("repeats", po::value<uint32_t>(&repeats),
+     "The number of different splits to make (default 1)")
+    ("seed", po::value<uint32_t>(&seed),
+     "The seed for the random number generator (default the time)")
+    ("output", po::value<std::string>(&output),
+     "Write each split to <output>.test and <output>.train (or "
+     "<output>.<n>.test and <output>.<n>.train, with repeats), instead of "
+     "writing the sample to standard output")
+    ("format", po::value<std::string>(&format),
+     "text, to list the array names, or binary, for a list of their "
+     "indices (default text)")
+    ;
+
+  po::variables_map vm;
+
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  std::string wrong;
+  if (!vm.count("help"))
+  {
+    if (!vm.count("matrixdir"))
+      wrong = "matrixdir";
+    else if (!vm.count("num-samples"))
+      wrong = "num-samples";
+  }
+
+  if (wrong != "")
+    std::cerr << "Missing option: " << wrong << std::endl;
+  if (vm.count("help") || wrong != "")
+  {
+    std::cout << desc << std::endl;
+    return 1;
+  }
+
+  if (!fs::is_directory(matrixdir))
+  {
+    std::cout << "Matrix directory doesn't exist."
+              << std::endl;
+    return 1;
+  }
+
+  if (format != "text" && format != "binary")
+  {
+    std::cout << "Format must be text or binary." << std::endl;
+    return 1;
+  }
+  bool binary = (format == "binary");
+
+  if (output == "" && (repeats != 1 || binary))
+  {
+    std::cout << "Repeated or binary splits need an output prefix."
+              << std::endl;
+    return 1;
+  }
+
+  fs::path dir(matrixdir);
+  NameIndex arrays;
+  arrays.load((dir / "arrays").string(), (dir / "arrays.index").string());
+  uint32_t nArrays = arrays.size();
+
+  // 1 marks the population sampled from.
+  std::vector<char> population(nArrays, includes.empty() ? 1 : 0);
+  uint32_t missing = 0;
+  for (std::vector<std::string>::iterator i = includes.begin();
+       i != includes.end();
+       i++)
+    missing += mark_arrays(arrays, *i, population, 1);
+  for (std::vector<std::string>::iterator i = excludes.begin();
+       i != excludes.end();
+       i++)
+    missing += mark_arrays(arrays, *i, population, 0);
+
+  std::vector<uint32_t> classes(nArrays, 0);
+  if (strata != "")
+    missing += read_strata(arrays, strata, classes);
+  if (missing != 0)
+    std::cerr << missing << " arrays listed weren't in the matrix."
+              << std::endl;
+
+  // The population in each stratum.
+  std::map<uint32_t, std::vector<uint32_t> > pools;
+  uint32_t nPopulation = 0;
+  for (uint32_t a = 0; a < nArrays; a++)
+    if (population[a])
+    {
+      pools[classes[a]].push_back(a);
+      nPopulation++;
+    }
+
+  if (numSamples > nPopulation)
+  {
+    std::cout << "Can't sample " << numSamples << " arrays from only "
+              << nPopulation << "." << std::endl;
+    return 1;
+  }
+
+  // Each stratum gets its share of the samples rounded down, and then the
+  // ones left over go to the strata which lost the most by rounding.
+  std::map<uint32_t, uint32_t> counts;
+  std::vector<std::pair<uint64_t, uint32_t> > remainders;
+  uint32_t allocated = 0;
+  for (std::map<uint32_t, std::vector<uint32_t> >::iterator i = pools.begin();
+       i != pools.end();
+       i++)
+  {
+    uint64_t share = static_cast<uint64_t>(numSamples) * i->second.size();
+    counts[i->first] = share / nPopulation;
+    allocated += share / nPopulation;
+    remainders.push_back(std::pair<uint64_t, uint32_t>
+                         (nPopulation - share % nPopulation, i->first));
+  }
+  std::sort(remainders.begin(), remainders.end());
+  for (uint32_t i = 0; allocated < numSamples; i++, allocated++)
+    counts[remainders[i].second]++;
+
+  std::cerr << "Sampling with seed " << seed << std::endl;
+  boost::mt19937 generator(seed);
+  RandomNumbers random(generator);
+
+  for (uint32_t r = 0; r < repeats; r++)
+  {
+    // 2 marks the sample; the rest of the population is left as 1.
+    std::vector<char> split(population);
+    for (std::map<uint32_t, std::vector<uint32_t> >::iterator i =
+           pools.begin();
+         i != pools.end();
+         i++)
+    {
+      sample(i->second, counts[i->first], random);
+      for (uint32_t j = 0; j < counts[i->first]; j++)
+        split[i->second[j]] = 2;
+    }
+
+    if (output == "")
+    {
+      if (!write_set(arrays, split, 2, "", false))
+        return 1;
+      continue;
+    }
+
+    std::ostringstream prefix;
+    prefix << output;
+    if (repeats != 1)
+      prefix << "." << (r + 1);
+    if (!write_set(arrays, split, 2, prefix.str() + ".test", binary) ||
+        !write_set(arrays, split, 1, prefix.str() + ".train", binary))
+      return 1;
+  }
+
+  return 0;
+}
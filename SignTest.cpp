@@ -0,0 +1,310 @@
+/*
+    Vectorised comparison loops for the sign tests.
+    Copyright (C) 2008-2009  Andrew Miller
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "SignTest.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SIGNTEST_X86
+#include <immintrin.h>
+#endif
+
+static void
+scalarCount(const double* aControl, const double* aModel, size_t aCount,
+            uint32_t& aGreater, uint32_t& aTotal)
+{
+  for (size_t i = 0; i < aCount; i++)
+  {
+    if (isfinite(aControl[i]) && isfinite(aModel[i]) &&
+        aControl[i] != aModel[i])
+    {
+      aGreater += (aControl[i] >= aModel[i]);
+      aTotal++;
+    }
+  }
+}
+
+static void
+scalarCountByGene(const double* aControl, const double* aModel,
+                  uint32_t aCount, uint32_t* aControlWorse, uint32_t* aTotal)
+{
+  for (uint32_t i = 0; i < aCount; i++)
+  {
+    if (finite(aControl[i]) && finite(aModel[i]))
+    {
+      aTotal[i]++;
+      aControlWorse[i] += (aControl[i] >= aModel[i]);
+    }
+  }
+}
+
+#ifdef SIGNTEST_X86
+
+// A value is finite when its magnitude is below infinity; NaNs compare
+// false. The masks are turned into bits and counted with popcount, so there
+// are no branches on the data.
+
+static void
+sse2Count(const double* aControl, const double* aModel, size_t aCount,
+          uint32_t& aGreater, uint32_t& aTotal)
+{
+  const __m128d magnitude = _mm_castsi128_pd(_mm_set1_epi64x(0x7FFFFFFFFFFFFFFFLL)),
+    infinity = _mm_set1_pd(HUGE_VAL);
+  uint32_t greater = 0, total = 0;
+  size_t i = 0;
+  for (; i + 2 <= aCount; i += 2)
+  {
+    __m128d c = _mm_loadu_pd(aControl + i), m = _mm_loadu_pd(aModel + i);
+    __m128d trial =
+      _mm_and_pd(_mm_and_pd(_mm_cmplt_pd(_mm_and_pd(c, magnitude), infinity),
+                            _mm_cmplt_pd(_mm_and_pd(m, magnitude), infinity)),
+                 _mm_cmpneq_pd(c, m));
+    uint32_t t = _mm_movemask_pd(trial);
+    total += __builtin_popcount(t);
+    greater += __builtin_popcount(t & _mm_movemask_pd(_mm_cmpgt_pd(c, m)));
+  }
+  aGreater += greater;
+  aTotal += total;
+  scalarCount(aControl + i, aModel + i, aCount - i, aGreater, aTotal);
+}
+
+static void
+sse2CountByGene(const double* aControl, const double* aModel,
+                uint32_t aCount, uint32_t* aControlWorse, uint32_t* aTotal)
+{
+  const __m128d magnitude = _mm_castsi128_pd(_mm_set1_epi64x(0x7FFFFFFFFFFFFFFFLL)),
+    infinity = _mm_set1_pd(HUGE_VAL);
+  uint32_t i = 0;
+  for (; i + 2 <= aCount; i += 2)
+  {
+    __m128d c = _mm_loadu_pd(aControl + i), m = _mm_loadu_pd(aModel + i);
+    __m128d both =
+      _mm_and_pd(_mm_cmplt_pd(_mm_and_pd(c, magnitude), infinity),
+                 _mm_cmplt_pd(_mm_and_pd(m, magnitude), infinity));
+    __m128d worse = _mm_and_pd(both, _mm_cmpge_pd(c, m));
+
+    // Each mask lane is all ones, i.e. -1, so subtracting its low half from
+    // the count adds one.
+    __m128i b = _mm_shuffle_epi32(_mm_castpd_si128(both), _MM_SHUFFLE(3, 3, 2, 0)),
+      w = _mm_shuffle_epi32(_mm_castpd_si128(worse), _MM_SHUFFLE(3, 3, 2, 0));
+    __m128i* t = reinterpret_cast<__m128i*>(aTotal + i),
+      * cw = reinterpret_cast<__m128i*>(aControlWorse + i);
+    _mm_storel_epi64(t, _mm_sub_epi32(_mm_loadl_epi64(t), b));
+    _mm_storel_epi64(cw, _mm_sub_epi32(_mm_loadl_epi64(cw), w));
+  }
+  scalarCountByGene(aControl + i, aModel + i, aCount - i, aControlWorse + i,
+                    aTotal + i);
+}
+
+__attribute__((target("avx2,popcnt")))
+static void
+avx2Count(const double* aControl, const double* aModel, size_t aCount,
+          uint32_t& aGreater, uint32_t& aTotal)
+{
+  const __m256d magnitude =
+    _mm256_castsi256_pd(_mm256_set1_epi64x(0x7FFFFFFFFFFFFFFFLL)),
+    infinity = _mm256_set1_pd(HUGE_VAL);
+  uint32_t greater = 0, total = 0;
+  size_t i = 0;
+  for (; i + 4 <= aCount; i += 4)
+  {
+    __m256d c = _mm256_loadu_pd(aControl + i), m = _mm256_loadu_pd(aModel + i);
+    __m256d trial = _mm256_and_pd
+      (_mm256_and_pd(_mm256_cmp_pd(_mm256_and_pd(c, magnitude), infinity,
+                                   _CMP_LT_OQ),
+                     _mm256_cmp_pd(_mm256_and_pd(m, magnitude), infinity,
+                                   _CMP_LT_OQ)),
+       _mm256_cmp_pd(c, m, _CMP_NEQ_OQ));
+    uint32_t t = _mm256_movemask_pd(trial);
+    total += _mm_popcnt_u32(t);
+    greater += _mm_popcnt_u32(t & _mm256_movemask_pd(_mm256_cmp_pd(c, m,
+                                                                   _CMP_GT_OQ)));
+  }
+  aGreater += greater;
+  aTotal += total;
+  scalarCount(aControl + i, aModel + i, aCount - i, aGreater, aTotal);
+}
+
+__attribute__((target("avx2")))
+static void
+avx2CountByGene(const double* aControl, const double* aModel,
+                uint32_t aCount, uint32_t* aControlWorse, uint32_t* aTotal)
+{
+  const __m256d magnitude =
+    _mm256_castsi256_pd(_mm256_set1_epi64x(0x7FFFFFFFFFFFFFFFLL)),
+    infinity = _mm256_set1_pd(HUGE_VAL);
+  const __m256i lowHalves = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+  uint32_t i = 0;
+  for (; i + 4 <= aCount; i += 4)
+  {
+    __m256d c = _mm256_loadu_pd(aControl + i), m = _mm256_loadu_pd(aModel + i);
+    __m256d both = _mm256_and_pd
+      (_mm256_cmp_pd(_mm256_and_pd(c, magnitude), infinity, _CMP_LT_OQ),
+       _mm256_cmp_pd(_mm256_and_pd(m, magnitude), infinity, _CMP_LT_OQ));
+    __m256d worse = _mm256_and_pd(both, _mm256_cmp_pd(c, m, _CMP_GE_OQ));
+
+    __m128i b = _mm256_castsi256_si128
+      (_mm256_permutevar8x32_epi32(_mm256_castpd_si256(both), lowHalves)),
+      w = _mm256_castsi256_si128
+      (_mm256_permutevar8x32_epi32(_mm256_castpd_si256(worse), lowHalves));
+    __m128i* t = reinterpret_cast<__m128i*>(aTotal + i),
+      * cw = reinterpret_cast<__m128i*>(aControlWorse + i);
+    _mm_storeu_si128(t, _mm_sub_epi32(_mm_loadu_si128(t), b));
+    _mm_storeu_si128(cw, _mm_sub_epi32(_mm_loadu_si128(cw), w));
+  }
+  scalarCountByGene(aControl + i, aModel + i, aCount - i, aControlWorse + i,
+                    aTotal + i);
+}
+
+__attribute__((target("avx512f,popcnt")))
+static void
+avx512Count(const double* aControl, const double* aModel, size_t aCount,
+            uint32_t& aGreater, uint32_t& aTotal)
+{
+  const __m512d infinity = _mm512_set1_pd(HUGE_VAL);
+  uint32_t greater = 0, total = 0;
+  size_t i = 0;
+  for (; i + 8 <= aCount; i += 8)
+  {
+    __m512d c = _mm512_loadu_pd(aControl + i), m = _mm512_loadu_pd(aModel + i);
+    __mmask8 trial =
+      _mm512_cmp_pd_mask(_mm512_abs_pd(c), infinity, _CMP_LT_OQ) &
+      _mm512_cmp_pd_mask(_mm512_abs_pd(m), infinity, _CMP_LT_OQ) &
+      _mm512_cmp_pd_mask(c, m, _CMP_NEQ_OQ);
+    total += _mm_popcnt_u32(trial);
+    greater += _mm_popcnt_u32(trial & _mm512_cmp_pd_mask(c, m, _CMP_GT_OQ));
+  }
+  aGreater += greater;
+  aTotal += total;
+  scalarCount(aControl + i, aModel + i, aCount - i, aGreater, aTotal);
+}
+
+__attribute__((target("avx512f")))
+static void
+avx512CountByGene(const double* aControl, const double* aModel,
+                  uint32_t aCount, uint32_t* aControlWorse, uint32_t* aTotal)
+{
+  const __m512d infinity = _mm512_set1_pd(HUGE_VAL);
+  const __m512i one = _mm512_set1_epi32(1);
+  uint32_t i = 0;
+  for (; i + 8 <= aCount; i += 8)
+  {
+    __m512d c = _mm512_loadu_pd(aControl + i), m = _mm512_loadu_pd(aModel + i);
+    __mmask8 both =
+      _mm512_cmp_pd_mask(_mm512_abs_pd(c), infinity, _CMP_LT_OQ) &
+      _mm512_cmp_pd_mask(_mm512_abs_pd(m), infinity, _CMP_LT_OQ);
+    __mmask8 worse = both & _mm512_cmp_pd_mask(c, m, _CMP_GE_OQ);
+
+    // Only the low eight counts of each vector are loaded or stored.
+    __m512i t = _mm512_maskz_loadu_epi32(0xFF, aTotal + i),
+      cw = _mm512_maskz_loadu_epi32(0xFF, aControlWorse + i);
+    _mm512_mask_storeu_epi32(aTotal + i, 0xFF,
+                             _mm512_mask_add_epi32(t, both, t, one));
+    _mm512_mask_storeu_epi32(aControlWorse + i, 0xFF,
+                             _mm512_mask_add_epi32(cw, worse, cw, one));
+  }
+  scalarCountByGene(aControl + i, aModel + i, aCount - i, aControlWorse + i,
+                    aTotal + i);
+}
+
+#endif
+
+static bool
+bestKernels(SignTestKernels::CountKernel& aCount,
+            SignTestKernels::GeneKernel& aCountByGene)
+{
+#ifdef SIGNTEST_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("popcnt"))
+  {
+    aCount = avx512Count;
+    aCountByGene = avx512CountByGene;
+    return true;
+  }
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt"))
+  {
+    aCount = avx2Count;
+    aCountByGene = avx2CountByGene;
+    return true;
+  }
+  if (__builtin_cpu_supports("sse2"))
+  {
+    aCount = sse2Count;
+    aCountByGene = sse2CountByGene;
+    return true;
+  }
+#endif
+  aCount = scalarCount;
+  aCountByGene = scalarCountByGene;
+  return true;
+}
+
+static SignTestKernels::CountKernel
+bestCountKernel()
+{
+  SignTestKernels::CountKernel count;
+  SignTestKernels::GeneKernel countByGene;
+  bestKernels(count, countByGene);
+  return count;
+}
+
+static SignTestKernels::GeneKernel
+bestGeneKernel()
+{
+  SignTestKernels::CountKernel count;
+  SignTestKernels::GeneKernel countByGene;
+  bestKernels(count, countByGene);
+  return countByGene;
+}
+
+SignTestKernels::CountKernel SignTestKernels::sCount = bestCountKernel();
+SignTestKernels::GeneKernel SignTestKernels::sCountByGene = bestGeneKernel();
+
+bool
+SignTestKernels::select(const std::string& aName)
+{
+  if (aName == "auto")
+    return bestKernels(sCount, sCountByGene);
+  else if (aName == "scalar")
+  {
+    sCount = scalarCount;
+    sCountByGene = scalarCountByGene;
+  }
+#ifdef SIGNTEST_X86
+  else if (aName == "sse2" && __builtin_cpu_supports("sse2"))
+  {
+    sCount = sse2Count;
+    sCountByGene = sse2CountByGene;
+  }
+  else if (aName == "avx2" && __builtin_cpu_supports("avx2") &&
+           __builtin_cpu_supports("popcnt"))
+  {
+    sCount = avx2Count;
+    sCountByGene = avx2CountByGene;
+  }
+  else if (aName == "avx512" && __builtin_cpu_supports("avx512f") &&
+           __builtin_cpu_supports("popcnt"))
+  {
+    sCount = avx512Count;
+    sCountByGene = avx512CountByGene;
+  }
+#endif
+  else
+    return false;
+
+  return true;
+}
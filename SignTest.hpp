@@ -0,0 +1,197 @@
+/*
+    Sign test accumulators shared by the sign test tools and TestSVMs.
+    Copyright (C) 2008-2009  Andrew Miller
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SIGNTEST_HPP
+#define SIGNTEST_HPP
+
+#include <inttypes.h>
+#include <math.h>
+#include <algorithm>
+#include <fstream>
+#include <list>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// The comparison loops behind SignTest and GeneSignTest, in SignTest.cpp,
+// with versions for each width of vector the processor might have.
+class SignTestKernels
+{
+public:
+  // Adds to aTotal the number of pairs where both errors are finite and
+  // they differ, and to aGreater the number of those where the control's
+  // is greater.
+  static void count(const double* aControl, const double* aModel,
+                    size_t aCount, uint32_t& aGreater, uint32_t& aTotal)
+  {
+    sCount(aControl, aModel, aCount, aGreater, aTotal);
+  }
+
+  // For each i where both errors are finite, adds one to aTotal[i], and to
+  // aControlWorse[i] if the control's is at least as great.
+  static void countByGene(const double* aControl, const double* aModel,
+                          uint32_t aCount, uint32_t* aControlWorse,
+                          uint32_t* aTotal)
+  {
+    sCountByGene(aControl, aModel, aCount, aControlWorse, aTotal);
+  }
+
+  // Picks the implementation: "auto" for the widest the CPU supports, or
+  // "scalar", "sse2", "avx2" or "avx512". Returns false if the CPU can't
+  // run the one asked for.
+  static bool select(const std::string& aName);
+
+  typedef void (*CountKernel)(const double* aControl, const double* aModel,
+                              size_t aCount, uint32_t& aGreater,
+                              uint32_t& aTotal);
+  typedef void (*GeneKernel)(const double* aControl, const double* aModel,
+                             uint32_t aCount, uint32_t* aControlWorse,
+                             uint32_t* aTotal);
+
+private:
+  static CountKernel sCount;
+  static GeneKernel sCountByGene;
+};
+
+// Counts, over every gene and array together, how often the control's error
+// was greater than the model's. Ties and missing values aren't trials.
+class SignTest
+{
+public:
+  SignTest()
+    : mnGreater(0), mnTotal(0)
+  {
+  }
+
+  void
+  add(const double* aControl, const double* aModel, size_t aCount)
+  {
+    SignTestKernels::count(aControl, aModel, aCount, mnGreater, mnTotal);
+  }
+
+  void
+  print(std::ostream& aOut) const
+  {
+    aOut << "Of " << mnTotal << " trials, the control had greater error "
+         << "in " << mnGreater << std::endl;
+  }
+
+  uint32_t getGreater() const { return mnGreater; }
+  uint32_t getTotal() const { return mnTotal; }
+
+  // The base 2 logarithm of the two-sided p value, if either error were as
+  // likely as the other to be the greater.
+  double
+  getLog2P() const
+  {
+    uint32_t n = mnTotal, x = std::min(mnGreater, mnTotal - mnGreater);
+
+    // log_2 of the sum of n choose i for i up to x, built up from the last
+    // term back.
+    double l = 0.0;
+    for (uint32_t i = x; i >= 1; i--)
+      l = addOneToExponential(log2((n + 1 - i) / (0.0 + i)) + l);
+
+    return (-static_cast<double>(n)) + 1.0 + l;
+  }
+
+private:
+  uint32_t mnGreater, mnTotal;
+
+  static double
+  addOneToExponential(double v)
+  {
+    // Approximation: for large v, log_2(2^v + 1) approx v
+    if (v > 30.0)
+      return v;
+
+    return log2(1.0 + pow(2.0, v));
+  }
+};
+
+// The same, a gene at a time. Here ties count as the control being worse,
+// so only missing values are left out.
+class GeneSignTest
+{
+public:
+  GeneSignTest(uint32_t anGenes)
+    : mControlWorse(anGenes, 0), mTotal(anGenes, 0)
+  {
+  }
+
+  // aControl and aModel are whole rows, one error per gene.
+  void
+  add(const double* aControl, const double* aModel)
+  {
+    if (!mTotal.empty())
+      SignTestKernels::countByGene(aControl, aModel, mTotal.size(),
+                                   &mControlWorse[0], &mTotal[0]);
+  }
+
+  // As above, but for just the genes in aGenes, whose errors are in the
+  // same order in aControl and aModel.
+  void
+  add(const double* aControl, const double* aModel,
+      const std::vector<uint32_t>& aGenes)
+  {
+    uint32_t n = aGenes.size(), nGenes = mTotal.size();
+    for (uint32_t i = 0; i < n; i++)
+    {
+      uint32_t g = aGenes[i];
+      if (g < nGenes && finite(aControl[i]) && finite(aModel[i]))
+      {
+        mTotal[g]++;
+        mControlWorse[g] += (aControl[i] >= aModel[i]);
+      }
+    }
+  }
+
+  void
+  print(std::ostream& aOut, const std::list<std::string>& aGenes) const
+  {
+    aOut << "\"gene\",\"total\",\"control.better\"" << std::endl;
+    uint32_t v = 0;
+    for (std::list<std::string>::const_iterator i = aGenes.begin();
+         i != aGenes.end() && v < mTotal.size();
+         i++, v++)
+      aOut << "\"" << *i << "\",\"" << mTotal[v] << "\",\""
+           << mControlWorse[v] << "\"" << std::endl;
+  }
+
+private:
+  std::vector<uint32_t> mControlWorse, mTotal;
+};
+
+static inline void
+loadGeneList(const std::string& aFileName, std::list<std::string>& aGenes)
+{
+  std::ifstream gl(aFileName.c_str());
+
+  while (gl.good())
+  {
+    std::string l;
+    std::getline(gl, l);
+
+    if (!gl.good())
+      break;
+
+    aGenes.push_back(l);
+  }
+}
+
+#endif
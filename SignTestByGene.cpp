@@ -25,6 +25,9 @@
 #include <iostream>
 #include <list>
 #include <fstream>
+#include <algorithm>
+#include "ErrorMatrix.hpp"
+#include "SignTest.hpp"
 
 namespace po = boost::program_options;
 namespace fs = boost::filesystem;
@@ -38,18 +41,20 @@ public:
    const std::string& aModel,
    const std::string& aGeneList
   )
-    : mfControl(NULL), mfModel(NULL)
+    : mControl(aControl), mModel(aModel), mSignTest(NULL)
   {
-    loadGeneList(aGeneList);
+    loadGeneList(aGeneList, mGenes);
+    mNGenes = mGenes.size();
 
-    mfControl = fopen(aControl.c_str(), "r");
-    mfModel = fopen(aModel.c_str(), "r");
-    mBuffer1 = new double[mNGenes];
-    mBuffer2 = new double[mNGenes];
-    mControlWorse = new uint32_t[mNGenes];
-    mTotal = new uint32_t[mNGenes];
-    memset(mControlWorse, 0, sizeof(uint32_t) * mNGenes);
-    memset(mTotal, 0, sizeof(uint32_t) * mNGenes);
+    mControl.setNumGenes(mNGenes);
+    mModel.setNumGenes(mNGenes);
+    // A sparse matrix's rows are spread out to however many genes it says
+    // it has, which needn't match the list.
+    mRowLength = std::max(mNGenes, std::max(mControl.getNumGenes(),
+                                            mModel.getNumGenes()));
+    mBuffer1 = new double[mRowLength];
+    mBuffer2 = new double[mRowLength];
+    mSignTest = new GeneSignTest(mNGenes);
 
     processFitData();
     dumpFitData();
@@ -57,95 +62,66 @@ public:
 
   ~SignTestFits()
   {
-    if (mfControl)
-      fclose(mfControl);
-    if (mfModel)
-      fclose(mfModel);
     if (mBuffer1)
       delete [] mBuffer1;
     if (mBuffer2)
       delete [] mBuffer2;
-    if (mControlWorse)
-      delete [] mControlWorse;
-    if (mTotal)
-      delete [] mTotal;
+    if (mSignTest)
+      delete mSignTest;
   }
 
   void
   processFitData()
   {
+    // Sparse matrices with the same genes can be compared as they are.
+    const std::vector<uint32_t>& genes(mControl.getModelledGenes());
+    if (mControl.isSparse() && mModel.isSparse() &&
+        genes == mModel.getModelledGenes())
+    {
+      std::vector<double> control(genes.size()), model(genes.size());
+      while (!genes.empty() && mControl.readRow(&control[0]) &&
+             mModel.readRow(&model[0]))
+        mSignTest->add(&control[0], &model[0], genes);
+      return;
+    }
+
+    // A sparse matrix which says it has fewer genes than the list only
+    // fills in that many, so the rest are left missing.
     while (true)
     {
-      if (fread(mBuffer1, sizeof(double), mNGenes, mfControl) !=
-          mNGenes)
+      std::fill(mBuffer1, mBuffer1 + mRowLength,
+                std::numeric_limits<double>::quiet_NaN());
+      if (!mControl.readFullRow(mBuffer1))
         break;
 
-      if (fread(mBuffer2, sizeof(double), mNGenes, mfModel) !=
-          mNGenes)
+      std::fill(mBuffer2, mBuffer2 + mRowLength,
+                std::numeric_limits<double>::quiet_NaN());
+      if (!mModel.readFullRow(mBuffer2))
         break;
 
-      updateSignStatistics();
+      mSignTest->add(mBuffer1, mBuffer2);
     }
   }
 
   void
   dumpFitData()
   {
-    std::cout << "\"gene\",\"total\",\"control.better\"" << std::endl;
-    uint32_t v = 0;
-    for (std::list<std::string>::iterator i = mGenes.begin();
-         i != mGenes.end();
-         i++, v++)
-      std::cout << "\"" << *i << "\",\"" << mTotal[v] << "\",\""
-                << mControlWorse[v] << "\"" << std::endl;
+    mSignTest->print(std::cout, mGenes);
   }
 
 private:
-  FILE * mfControl, * mfModel;
+  ErrorMatrixReader mControl, mModel;
   double * mBuffer1, * mBuffer2;
-  uint32_t * mControlWorse, * mTotal;
-  uint32_t mNGenes;
+  GeneSignTest * mSignTest;
+  uint32_t mNGenes, mRowLength;
   std::list<std::string> mGenes;
-
-  void
-  updateSignStatistics()
-  {
-    for (uint32_t i = 0; i < mNGenes; i++)
-    {
-      if (finite(mBuffer1[i]) && finite(mBuffer2[i]))
-      {
-        mTotal[i]++;
-        mControlWorse[i] += (mBuffer1[i] >= mBuffer2[i]);
-      }
-    }
-  }
-
-  void
-  loadGeneList(const std::string& aFileName)
-  {
-    std::ifstream gl(aFileName.c_str());
-
-    while (gl.good())
-    {
-      std::string l;
-      std::getline(gl, l);
-
-      if (!gl.good())
-        break;
-
-      mGenes.push_back(l);
-    }
-
-    // The + 1 is a workaround for a bug in the other tools due to the trailing newline.
-    mNGenes = mGenes.size();
-  }
 };
 
 int
 main(int argc, char** argv)
 {
   po::options_description desc;
-  std::string controlMatrix, modelMatrix, geneList;
+  std::string controlMatrix, modelMatrix, geneList, kernel("auto");
 
   desc.add_options()
     ("controlmatrix", po::value<std::string>(&controlMatrix),
@@ -154,6 +130,9 @@ main(int argc, char** argv)
      "The error matrix for the model expected to fit well")
     ("genelist", po::value<std::string>(&geneList),
      "The file containing the list of genes")
+    ("kernel", po::value<std::string>(&kernel),
+     "The comparison kernel: auto, scalar, sse2, avx2 or avx512 (default "
+     "auto, the widest the processor supports)")
     ;
 
   po::variables_map vm;
@@ -197,5 +176,12 @@ main(int argc, char** argv)
     std::cout << "Gene list not found." << std::endl;
   }
 
+  if (!SignTestKernels::select(kernel))
+  {
+    std::cout << "Kernel " << kernel << " isn't supported here."
+              << std::endl;
+    return 1;
+  }
+
   SignTestFits stf(controlMatrix, modelMatrix, geneList);
 }
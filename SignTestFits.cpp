@@ -17,11 +17,15 @@
 */
 #include <string>
 #include <cstdio>
+#include <cstdlib>
 #include <sys/types.h>
 #include <math.h>
+#include <sys/time.h>
 #include <boost/program_options.hpp>
 #include <boost/filesystem.hpp>
 #include <iostream>
+#include "ErrorMatrix.hpp"
+#include "SignTest.hpp"
 
 namespace po = boost::program_options;
 namespace fs = boost::filesystem;
@@ -34,25 +38,21 @@ public:
    const std::string& aControl,
    const std::string& aModel
   )
-    : mfControl(NULL), mfModel(NULL), mnGreater(0), mnTotal(0)
+    : mControl(aControl), mModel(aModel)
   {
-    mfControl = fopen(aControl.c_str(), "r");
-    mfModel = fopen(aModel.c_str(), "r");
     mBuffer1 = new double[kBufferSize];
     mBuffer2 = new double[kBufferSize];
 
-    processFitData();
+    if (!mControl.isSparse() && !mModel.isSparse())
+      processFitData();
+    else
+      processSparseFitData();
 
-    std::cout << "Of " << mnTotal << " trials, the control had greater error "
-              << "in " << mnGreater << std::endl;
+    mSignTest.print(std::cout);
   }
 
   ~SignTestFits()
   {
-    if (mfControl)
-      fclose(mfControl);
-    if (mfModel)
-      fclose(mfModel);
     if (mBuffer1)
       delete [] mBuffer1;
     if (mBuffer2)
@@ -64,48 +64,136 @@ public:
   {
     do
     {
-      mBufferUtilisation = fread(mBuffer1, sizeof(double), kBufferSize, mfControl);
-      if (fread(mBuffer2, sizeof(double), mBufferUtilisation, mfModel) != mBufferUtilisation)
+      mBufferUtilisation = fread(mBuffer1, sizeof(double), kBufferSize, mControl.getFile());
+      if (fread(mBuffer2, sizeof(double), mBufferUtilisation, mModel.getFile()) != mBufferUtilisation)
       {
         std::cerr << "Warning: read mismatch" << std::endl;
       }
-      updateSignStatistics();
+      mSignTest.add(mBuffer1, mBuffer2, mBufferUtilisation);
     }
     while (mBufferUtilisation == kBufferSize);
   }
 
+  // At least one of the matrices only has the modelled genes, so go a row at
+  // a time. If both have the same genes, there's no need to spread the rows
+  // back out to every gene.
+  void
+  processSparseFitData()
+  {
+    uint32_t nGenes = mControl.isSparse() ? mControl.getNumGenes() :
+      mModel.getNumGenes();
+    mControl.setNumGenes(nGenes);
+    mModel.setNumGenes(nGenes);
+
+    bool sameGenes =
+      (mControl.getModelledGenes() == mModel.getModelledGenes());
+    uint32_t n = sameGenes ? mControl.getModelledGenes().size() : nGenes;
+    if (n > kBufferSize)
+    {
+      std::cerr << "Rows are too long to sign test." << std::endl;
+      return;
+    }
+
+    while (true)
+    {
+      bool haveControl = sameGenes ? mControl.readRow(mBuffer1) :
+        mControl.readFullRow(mBuffer1);
+      bool haveModel = sameGenes ? mModel.readRow(mBuffer2) :
+        mModel.readFullRow(mBuffer2);
+      if (haveControl != haveModel)
+        std::cerr << "Warning: read mismatch" << std::endl;
+      if (!haveControl || !haveModel)
+        break;
+
+      mSignTest.add(mBuffer1, mBuffer2, n);
+    }
+  }
+
 private:
-  FILE * mfControl, * mfModel;
+  ErrorMatrixReader mControl, mModel;
   double * mBuffer1, * mBuffer2;
   static const uint32_t kBufferSize = 512000;
   uint32_t mBufferUtilisation;
-  uint32_t mnGreater, mnTotal;
+  SignTest mSignTest;
+};
 
-  void
-  updateSignStatistics()
+static double
+seconds_since(const timeval& aStart)
+{
+  timeval now;
+  gettimeofday(&now, NULL);
+  return (now.tv_sec - aStart.tv_sec) + (now.tv_usec - aStart.tv_usec) / 1E6;
+}
+
+// Times each comparison kernel the processor supports over aMegabytes of
+// made up errors for each matrix, with some missing values and ties, and
+// checks that they all count the same as the scalar one.
+static bool
+benchmark(uint32_t aMegabytes)
+{
+  size_t n = (static_cast<size_t>(aMegabytes) << 20) / sizeof(double);
+  std::vector<double> control(n), model(n);
+  srand(42);
+  for (size_t i = 0; i < n; i++)
   {
-    for (uint32_t i = 0; i < mBufferUtilisation; i++)
+    control[i] = rand() / (RAND_MAX + 1.0);
+    model[i] = (rand() % 16 == 0) ? control[i] : rand() / (RAND_MAX + 1.0);
+    if (rand() % 64 == 0)
+      control[i] = NAN;
+    if (rand() % 64 == 0)
+      model[i] = (rand() % 2) ? NAN : INFINITY;
+  }
+
+  static const char* const kKernels[] = { "scalar", "sse2", "avx2", "avx512" };
+  uint32_t scalarGreater = 0, scalarTotal = 0;
+  bool ok = true;
+  for (uint32_t k = 0; k < sizeof(kKernels) / sizeof(kKernels[0]); k++)
+  {
+    if (!SignTestKernels::select(kKernels[k]))
     {
-      if (isfinite(mBuffer1[i]) && isfinite(mBuffer2[i]) && mBuffer1[i] != mBuffer2[i])
-      {
-        mnGreater += (mBuffer1[i] >= mBuffer2[i]);
-        mnTotal++;
-      }
+      std::cout << kKernels[k] << ": not supported" << std::endl;
+      continue;
+    }
+
+    SignTest test;
+    timeval start;
+    gettimeofday(&start, NULL);
+    test.add(&control[0], &model[0], n);
+    double elapsed = seconds_since(start);
+
+    if (k == 0)
+    {
+      scalarGreater = test.getGreater();
+      scalarTotal = test.getTotal();
     }
+    bool same = (test.getGreater() == scalarGreater &&
+                 test.getTotal() == scalarTotal);
+    ok = ok && same;
+    std::cout << kKernels[k] << ": " << (2.0 * n * sizeof(double) / 1E9) /
+      elapsed << " GB/s, " << test.getGreater() << " of " << test.getTotal()
+              << (same ? "" : " (doesn't match scalar)") << std::endl;
   }
-};
+  return ok;
+}
 
 int
 main(int argc, char** argv)
 {
   po::options_description desc;
-  std::string controlMatrix, modelMatrix;
+  std::string controlMatrix, modelMatrix, kernel("auto");
+  uint32_t benchmarkSize = 256;
 
   desc.add_options()
     ("controlmatrix", po::value<std::string>(&controlMatrix),
      "The error matrix for the model expected to fit poorly")
     ("modelmatrix", po::value<std::string>(&modelMatrix),
      "The error matrix for the model expected to fit well")
+    ("kernel", po::value<std::string>(&kernel),
+     "The comparison kernel: auto, scalar, sse2, avx2 or avx512 (default "
+     "auto, the widest the processor supports)")
+    ("benchmark", po::value<uint32_t>(&benchmarkSize)->implicit_value(256),
+     "Time each kernel on this many megabytes of random errors per matrix "
+     "(default 256), instead of testing any matrices")
     ;
 
   po::variables_map vm;
@@ -113,6 +201,9 @@ main(int argc, char** argv)
   po::store(po::parse_command_line(argc, argv, desc), vm);
   po::notify(vm);
 
+  if (vm.count("benchmark"))
+    return benchmark(benchmarkSize) ? 0 : 1;
+
   std::string wrong;
   if (!vm.count("help"))
   {
@@ -142,5 +233,12 @@ main(int argc, char** argv)
     return 1;
   }
 
+  if (!SignTestKernels::select(kernel))
+  {
+    std::cout << "Kernel " << kernel << " isn't supported here."
+              << std::endl;
+    return 1;
+  }
+
   SignTestFits stf(controlMatrix, modelMatrix);
 }
@@ -19,6 +19,8 @@
 #include <boost/filesystem.hpp>
 #include <iostream>
 #include "SVMSupport.hpp"
+#include "ErrorMatrix.hpp"
+#include "SignTest.hpp"
 
 namespace po = boost::program_options;
 namespace fs = boost::filesystem;
@@ -26,17 +28,17 @@ namespace fs = boost::filesystem;
 class ResultSaver
 {
 public:
-  ResultSaver(uint32_t nGenes, const std::string& aFile)
-    : mnGenes(nGenes)
+  ResultSaver(uint32_t nGenes, const std::string& aFile,
+              const std::vector<uint32_t>& aModelled,
+              ErrorMatrixWriter::Format aFormat)
+    : mnGenes(nGenes), mOutput(aFile, nGenes, aModelled, aFormat)
   {
     mData = new double[nGenes];
-    mOutput = fopen(aFile.c_str(), "w");
   }
 
   ~ResultSaver()
   {
     delete [] mData;
-    fclose(mOutput);
   }
 
   void startRow(uint32_t aArray)
@@ -52,20 +54,240 @@ public:
 
   void endRow(uint32_t aArray)
   {
-    fwrite(mData, mnGenes * sizeof(double), 1, mOutput);
+    mOutput.writeRow(mData);
   }
 
 private:
   double* mData;
-  FILE* mOutput;
   uint32_t mnGenes;
+  ErrorMatrixWriter mOutput;
 };
 
+// Keeps the rows from a batch of arrays, so the model and the control can
+// be compared array by array.
+class RowCollector
+{
+public:
+  RowCollector(uint32_t nGenes, uint32_t nRows)
+    : mnGenes(nGenes), mData(static_cast<size_t>(nGenes) * nRows), mRow(0)
+  {
+  }
+
+  void clear() { mRow = 0; }
+  const double* getRow(uint32_t aRow) const
+  {
+    return &mData[static_cast<size_t>(aRow) * mnGenes];
+  }
+
+  void startRow(uint32_t /* aArray */)
+  {
+    std::fill(mData.begin() + static_cast<size_t>(mRow) * mnGenes,
+              mData.begin() + static_cast<size_t>(mRow + 1) * mnGenes,
+              std::numeric_limits<double>::quiet_NaN());
+  }
+
+  void result(uint32_t aGene, double aResult)
+  {
+    mData[static_cast<size_t>(mRow) * mnGenes + aGene] = aResult;
+  }
+
+  void endRow(uint32_t /* aArray */)
+  {
+    mRow++;
+  }
+
+private:
+  uint32_t mnGenes;
+  std::vector<double> mData;
+  uint32_t mRow;
+};
+
+static bool
+loadModelSVMs(GRNModel& aModel, const std::string& aSVMDir,
+              const std::string& aSVMArchive)
+{
+  if (aSVMArchive == "")
+  {
+    aModel.loadSVMs(aSVMDir);
+    return true;
+  }
+
+  if (aModel.loadSVMArchive(aSVMArchive))
+    return true;
+
+  std::cout << "Couldn't read the SVM archive " << aSVMArchive << "."
+            << std::endl;
+  return false;
+}
+
+static bool
+checkSVMs(const std::string& aSVMDir, const std::string& aSVMArchive)
+{
+  if (aSVMArchive != "")
+  {
+    if (fs::is_regular(aSVMArchive))
+      return true;
+
+    std::cout << "SVM archive doesn't exist or not regular file."
+              << std::endl;
+    return false;
+  }
+
+  if (fs::is_directory(aSVMDir))
+    return true;
+
+  std::cout << "SVM directory doesn't exist."
+            << std::endl;
+  return false;
+}
+
+// Tests the model and the control on the same arrays, a batch at a time, and
+// sign tests their errors as it goes, only writing out the error matrices if
+// they were asked for.
+static void
+testAgainstControl(GRNModel& aModel, GRNModel& aControl,
+                   const std::vector<uint32_t>& aTestingArrays,
+                   uint32_t anGenes, uint32_t aNumThreads,
+                   const std::string& aOutput,
+                   const std::string& aControlOutput,
+                   ErrorMatrixWriter::Format aFormat,
+                   const std::string& aByGene, const std::string& aGeneList)
+{
+  static const uint32_t kBatchArrays = 64;
+
+  SignTest signTest;
+  GeneSignTest geneSignTest(anGenes);
+  RowCollector modelRows(anGenes, kBatchArrays),
+    controlRows(anGenes, kBatchArrays);
+  std::vector<uint32_t> modelled;
+  ErrorMatrixWriter* output = NULL, * controlOutput = NULL;
+  if (aOutput != "")
+  {
+    aModel.getModelledGenes(modelled);
+    output = new ErrorMatrixWriter(aOutput, anGenes, modelled, aFormat);
+  }
+  if (aControlOutput != "")
+  {
+    aControl.getModelledGenes(modelled);
+    controlOutput = new ErrorMatrixWriter(aControlOutput, anGenes, modelled,
+                                          aFormat);
+  }
+
+  for (size_t first = 0; first < aTestingArrays.size(); first += kBatchArrays)
+  {
+    std::vector<uint32_t> batch
+      (aTestingArrays.begin() + first,
+       aTestingArrays.begin() + std::min(first + kBatchArrays,
+                                         aTestingArrays.size()));
+
+    modelRows.clear();
+    controlRows.clear();
+    aModel.testSVMs(batch, modelRows, aNumThreads);
+    aControl.testSVMs(batch, controlRows, aNumThreads);
+
+    for (uint32_t i = 0; i < batch.size(); i++)
+    {
+      const double* m = modelRows.getRow(i), * c = controlRows.getRow(i);
+      signTest.add(c, m, anGenes);
+      geneSignTest.add(c, m);
+
+      if (output)
+        output->writeRow(m);
+      if (controlOutput)
+        controlOutput->writeRow(c);
+    }
+  }
+
+  delete output;
+  delete controlOutput;
+
+  signTest.print(std::cout);
+
+  if (aByGene != "")
+  {
+    std::list<std::string> genes;
+    loadGeneList(aGeneList, genes);
+    std::ofstream byGene(aByGene.c_str());
+    geneSignTest.print(byGene, genes);
+  }
+}
+
+// Tests the model and the control in both double and single precision, and
+// reports how far apart the errors were and how many of the comparisons
+// between the model and the control came out the other way.
+static void
+checkPrecision(GRNModel& aModel, GRNModel& aControl,
+               const std::vector<uint32_t>& aTestingArrays, uint32_t anGenes,
+               uint32_t aNumThreads)
+{
+  static const uint32_t kBatchArrays = 64;
+
+  SignTest doubleTest, floatTest;
+  RowCollector modelRows(anGenes, kBatchArrays),
+    controlRows(anGenes, kBatchArrays),
+    modelFloatRows(anGenes, kBatchArrays),
+    controlFloatRows(anGenes, kBatchArrays);
+  uint64_t flipped = 0;
+  double worst = 0.0;
+
+  for (size_t first = 0; first < aTestingArrays.size(); first += kBatchArrays)
+  {
+    std::vector<uint32_t> batch
+      (aTestingArrays.begin() + first,
+       aTestingArrays.begin() + std::min(first + kBatchArrays,
+                                         aTestingArrays.size()));
+
+    modelRows.clear();
+    controlRows.clear();
+    modelFloatRows.clear();
+    controlFloatRows.clear();
+    aModel.setSinglePrecision(false);
+    aControl.setSinglePrecision(false);
+    aModel.testSVMs(batch, modelRows, aNumThreads);
+    aControl.testSVMs(batch, controlRows, aNumThreads);
+    aModel.setSinglePrecision(true);
+    aControl.setSinglePrecision(true);
+    aModel.testSVMs(batch, modelFloatRows, aNumThreads);
+    aControl.testSVMs(batch, controlFloatRows, aNumThreads);
+
+    for (uint32_t i = 0; i < batch.size(); i++)
+    {
+      const double* m = modelRows.getRow(i), * c = controlRows.getRow(i),
+        * mf = modelFloatRows.getRow(i), * cf = controlFloatRows.getRow(i);
+      doubleTest.add(c, m, anGenes);
+      floatTest.add(cf, mf, anGenes);
+
+      for (uint32_t g = 0; g < anGenes; g++)
+      {
+        if (isfinite(m[g]) && isfinite(mf[g]))
+          worst = std::max(worst, fabs(mf[g] - m[g]) / (1.0 + m[g]));
+        if (isfinite(c[g]) && isfinite(cf[g]))
+          worst = std::max(worst, fabs(cf[g] - c[g]) / (1.0 + c[g]));
+        if (isfinite(m[g]) && isfinite(c[g]) && isfinite(mf[g]) &&
+            isfinite(cf[g]) && ((c[g] > m[g]) != (cf[g] > mf[g])))
+          flipped++;
+      }
+    }
+  }
+
+  std::cout << "Double precision: ";
+  doubleTest.print(std::cout);
+  std::cout << "Single precision: ";
+  floatTest.print(std::cout);
+  std::cout << "Comparisons which came out differently: " << flipped
+            << std::endl
+            << "Largest relative difference in error: " << worst
+            << std::endl;
+}
+
 int
 main(int argc, char** argv)
 {
   po::options_description desc;
-  std::string matrixdir, model, svmdir, testingset, output;
+  std::string matrixdir, model, svmdir, svmarchive, testingset, output,
+    kernel("auto"), controlmodel, controlsvmdir, controlsvmarchive,
+    controloutput, bygene, outputFormat("dense");
+  uint32_t threads = 1;
 
   desc.add_options()
     ("matrixdir", po::value<std::string>(&matrixdir),
@@ -74,11 +296,44 @@ main(int argc, char** argv)
      "The gene regulatory network model")
     ("svmdir", po::value<std::string>(&svmdir),
      "The directory containing the support vector machines")
+    ("svmarchive", po::value<std::string>(&svmarchive),
+     "A packed archive of the support vector machines, instead of svmdir")
     ("testingset", po::value<std::string>(&testingset),
      "The list of arrays which have been selected for inclusion in the "
      "testing set")
     ("output", po::value<std::string>(&output),
      "The file to write the per-array data into")
+    ("output-format", po::value<std::string>(&outputFormat),
+     "dense for a double for every gene in every array, or sparse or "
+     "sparse-float for just the genes with SVMs (default dense)")
+    ("no-mmap", "Read each array from the data file instead of mapping it")
+    ("threads", po::value<uint32_t>(&threads),
+     "The number of threads to spread the testing arrays across (default 1)")
+    ("kernel", po::value<std::string>(&kernel),
+     "How to evaluate the SVMs: auto, scalar, avx2, avx512, or libsvm to "
+     "make one libsvm prediction at a time (default auto)")
+    ("check-kernel",
+     "Compare the kernel against libsvm on the testing set instead of "
+     "writing any output")
+    ("single-precision",
+     "Read the arrays (from data32, if ConvertMatrix has made one) and "
+     "evaluate the SVMs in single precision")
+    ("check-precision",
+     "Test against controlmodel in both double and single precision, and "
+     "report how much the results differ, instead of writing any output "
+     "(always reads the data in double precision)")
+    ("controlmodel", po::value<std::string>(&controlmodel),
+     "A model expected to fit poorly (e.g. a scrambled one) to sign test "
+     "against as the arrays are tested, in which case output is optional")
+    ("controlsvmdir", po::value<std::string>(&controlsvmdir),
+     "The directory containing the support vector machines for controlmodel")
+    ("controlsvmarchive", po::value<std::string>(&controlsvmarchive),
+     "A packed archive of the control SVMs, instead of controlsvmdir")
+    ("controloutput", po::value<std::string>(&controloutput),
+     "The file to write the control's per-array data into (optional)")
+    ("bygene", po::value<std::string>(&bygene),
+     "The file to write the sign tests for each gene into, as SignTestByGene "
+     "does (optional)")
     ;
 
   po::variables_map vm;
@@ -93,12 +348,18 @@ main(int argc, char** argv)
       wrong = "matrixdir";
     else if (!vm.count("model"))
       wrong = "model";
-    else if (!vm.count("svmdir"))
+    else if (!vm.count("svmdir") && !vm.count("svmarchive"))
       wrong = "svmdir";
     else if (!vm.count("testingset"))
       wrong = "testingset";
-    else if (!vm.count("output"))
+    else if (!vm.count("output") && !vm.count("check-kernel") &&
+             !vm.count("controlmodel"))
       wrong = "output";
+    else if (vm.count("check-precision") && !vm.count("controlmodel"))
+      wrong = "controlmodel";
+    else if (vm.count("controlmodel") && !vm.count("controlsvmdir") &&
+             !vm.count("controlsvmarchive"))
+      wrong = "controlsvmdir";
   }
 
   if (wrong != "")
@@ -123,13 +384,29 @@ main(int argc, char** argv)
     return 1;
   }
 
-  if (!fs::is_directory(svmdir))
+  if (!checkSVMs(svmdir, svmarchive))
+    return 1;
+
+  if (vm.count("check-kernel") && vm.count("svmarchive"))
   {
-    std::cout << "SVM directory doesn't exist."
-              << std::endl;
+    std::cout << "Archives only hold the dense models, so --check-kernel "
+                 "needs --svmdir." << std::endl;
     return 1;
   }
 
+  if (vm.count("controlmodel"))
+  {
+    if (!fs::is_regular(controlmodel))
+    {
+      std::cout << "Control model file doesn't exist or not regular file."
+                << std::endl;
+      return 1;
+    }
+
+    if (!checkSVMs(controlsvmdir, controlsvmarchive))
+      return 1;
+  }
+
   if (!fs::is_regular(testingset))
   {
     std::cout << "Testing set file doesn't exist or not regular file."
@@ -137,13 +414,80 @@ main(int argc, char** argv)
     return 1;
   }
 
-  ExpressionMatrixProcessor emp(matrixdir);
+  ErrorMatrixWriter::Format format;
+  if (!ErrorMatrixWriter::parseFormat(outputFormat, format))
+  {
+    std::cout << "Unknown output format " << outputFormat << "." << std::endl;
+    return 1;
+  }
+
+  if (kernel != "libsvm" && !DenseRBFModel::selectKernel(kernel))
+  {
+    std::cout << "Kernel " << kernel << " isn't supported here."
+              << std::endl;
+    return 1;
+  }
+
+  bool singlePrecision = vm.count("single-precision");
+  if ((singlePrecision || vm.count("check-precision")) && kernel == "libsvm")
+  {
+    std::cout << "libsvm can only work in double precision." << std::endl;
+    return 1;
+  }
+
+  // The double precision half of --check-precision has to read the real
+  // data; the single precision half rounds it as it reads each array.
+  ExpressionMatrixProcessor emp
+    (matrixdir, vm.count("no-mmap") ? ExpressionMatrixProcessor::kStreamedAccess :
+                ExpressionMatrixProcessor::kMappedRandomAccess,
+     singlePrecision && !vm.count("check-precision"));
   GRNModel m(model, emp);
-  ResultSaver rs(emp.getNumGenes(), output);
-  m.loadSVMs(svmdir);
+  if (!loadModelSVMs(m, svmdir, svmarchive))
+    return 1;
+  m.setDenseModels(kernel != "libsvm");
+  m.setSinglePrecision(singlePrecision);
 
-  std::list<std::string> testingSet;
-  m.loadArraySet(testingset, testingSet);
-  
-  m.testSVMs(testingSet, rs);
+  ArraySet testingSet;
+  if (!testingSet.load(emp, testingset))
+  {
+    std::cout << "Couldn't use the testing set " << testingset << "."
+              << std::endl;
+    return 1;
+  }
+
+  if (vm.count("check-kernel"))
+  {
+    double error = m.compareDenseModels(testingSet);
+    std::cout << "Largest relative difference from libsvm: " << error
+              << std::endl;
+    return (error <= 1E-9) ? 0 : 1;
+  }
+
+  if (vm.count("controlmodel"))
+  {
+    GRNModel c(controlmodel, emp);
+    if (!loadModelSVMs(c, controlsvmdir, controlsvmarchive))
+      return 1;
+    c.setDenseModels(kernel != "libsvm");
+    c.setSinglePrecision(singlePrecision);
+
+    if (vm.count("check-precision"))
+    {
+      checkPrecision(m, c, testingSet.getListed(), emp.getNumGenes(),
+                     threads);
+      return 0;
+    }
+
+    fs::path genes(matrixdir);
+    genes /= "genes";
+    testAgainstControl(m, c, testingSet.getListed(), emp.getNumGenes(),
+                       threads, output, controloutput, format, bygene,
+                       genes.string());
+    return 0;
+  }
+
+  std::vector<uint32_t> modelled;
+  m.getModelledGenes(modelled);
+  ResultSaver rs(emp.getNumGenes(), output, modelled, format);
+  m.testSVMs(testingSet.getListed(), rs, threads);
 }
@@ -0,0 +1,103 @@
+/*
+    Work-stealing thread pool
+    Copyright (C) 2008-2009  Andrew Miller
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ThreadPool.hpp"
+#include <boost/thread/thread.hpp>
+#include <boost/bind.hpp>
+
+ThreadPool::ThreadPool(uint32_t aNumThreads)
+  : mNextQueue(0)
+{
+  if (aNumThreads == 0)
+    aNumThreads = 1;
+
+  for (uint32_t i = 0; i < aNumThreads; i++)
+    mQueues.push_back(new WorkerQueue());
+}
+
+ThreadPool::~ThreadPool()
+{
+  for (std::vector<WorkerQueue*>::iterator i = mQueues.begin();
+       i != mQueues.end();
+       i++)
+    delete *i;
+}
+
+void
+ThreadPool::add(const Task& aTask)
+{
+  mQueues[mNextQueue]->mTasks.push_back(aTask);
+  mNextQueue = (mNextQueue + 1) % mQueues.size();
+}
+
+void
+ThreadPool::run()
+{
+  if (mQueues.size() == 1)
+    work(0);
+  else
+  {
+    boost::thread_group threads;
+    for (uint32_t i = 1; i < mQueues.size(); i++)
+      threads.create_thread(boost::bind(&ThreadPool::work, this, i));
+
+    work(0);
+    threads.join_all();
+  }
+
+  mNextQueue = 0;
+}
+
+void
+ThreadPool::work(uint32_t aWorker)
+{
+  Task t;
+  while (takeTask(aWorker, t))
+    t();
+}
+
+bool
+ThreadPool::takeTask(uint32_t aWorker, Task& aTask)
+{
+  {
+    WorkerQueue& own(*mQueues[aWorker]);
+    boost::mutex::scoped_lock l(own.mLock);
+    if (!own.mTasks.empty())
+    {
+      aTask = own.mTasks.front();
+      own.mTasks.pop_front();
+      return true;
+    }
+  }
+
+  // No tasks get added while the pool is running, so once every queue has
+  // been seen empty there is nothing left to do.
+  for (uint32_t i = 1; i < mQueues.size(); i++)
+  {
+    WorkerQueue& victim(*mQueues[(aWorker + i) % mQueues.size()]);
+    boost::mutex::scoped_lock l(victim.mLock);
+    if (!victim.mTasks.empty())
+    {
+      aTask = victim.mTasks.back();
+      victim.mTasks.pop_back();
+      return true;
+    }
+  }
+
+  return false;
+}
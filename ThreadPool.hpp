@@ -0,0 +1,63 @@
+/*
+    Work-stealing thread pool
+    Copyright (C) 2008-2009  Andrew Miller
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef THREADPOOL_HPP
+#define THREADPOOL_HPP
+
+#include <inttypes.h>
+#include <deque>
+#include <vector>
+#include <boost/function.hpp>
+#include <boost/thread/mutex.hpp>
+
+// Runs a batch of independent tasks across a fixed number of threads. Tasks
+// are dealt out round-robin in the order they were added, so adding the most
+// expensive ones first gets them started first; each thread works from the
+// front of its own queue and, once that runs dry, steals from the back of
+// the others'.
+class ThreadPool
+{
+public:
+  typedef boost::function<void ()> Task;
+
+  ThreadPool(uint32_t aNumThreads);
+  ~ThreadPool();
+
+  void add(const Task& aTask);
+
+  // Runs every task added so far, returning once they have all finished.
+  // With only one thread, they are run in order on the calling thread.
+  void run();
+
+  uint32_t getNumThreads() const { return mQueues.size(); }
+
+private:
+  struct WorkerQueue
+  {
+    boost::mutex mLock;
+    std::deque<Task> mTasks;
+  };
+
+  std::vector<WorkerQueue*> mQueues;
+  uint32_t mNextQueue;
+
+  void work(uint32_t aWorker);
+  bool takeTask(uint32_t aWorker, Task& aTask);
+};
+
+#endif
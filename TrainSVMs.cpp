@@ -28,9 +28,10 @@ int
 main(int argc, char** argv)
 {
   po::options_description desc;
-  std::string matrixdir, model, svmdir, trainingset;
+  std::string matrixdir, model, svmdir, svmarchive, trainingset;
   double loggamma, logC, nu;
   bool dontReplace;
+  uint32_t threads = 1, readAhead = 4;
 
   desc.add_options()
     ("matrixdir", po::value<std::string>(&matrixdir),
@@ -39,6 +40,9 @@ main(int argc, char** argv)
      "The gene regulatory network model")
     ("svmdir", po::value<std::string>(&svmdir),
      "The directory containing the support vector machines")
+    ("svmarchive", po::value<std::string>(&svmarchive),
+     "A packed archive to write the support vector machines into, as well as "
+     "or instead of svmdir")
     ("trainingset", po::value<std::string>(&trainingset),
      "The list of arrays which have been selected for inclusion in the training set")
     ("gamma", po::value<double>(&loggamma),
@@ -48,6 +52,12 @@ main(int argc, char** argv)
     ("nu", po::value<double>(&nu),
      "The value of the SVM parameter nu, as a base-e logarithm of the value")
     ("dont-replace", "Indicates that existing SVMs shouldn't be replaced")
+    ("no-mmap", "Read each array from the data file instead of mapping it")
+    ("threads", po::value<uint32_t>(&threads),
+     "The number of SVMs to train at once (default 1)")
+    ("read-ahead", po::value<uint32_t>(&readAhead),
+     "The number of arrays to read in the background ahead of the one being "
+     "loaded (default 4; 0 reads each one as it is needed)")
     ;
 
   po::variables_map vm;
@@ -62,7 +72,7 @@ main(int argc, char** argv)
       wrong = "matrixdir";
     else if (!vm.count("model"))
       wrong = "model";
-    else if (!vm.count("svmdir"))
+    else if (!vm.count("svmdir") && !vm.count("svmarchive"))
       wrong = "svmdir";
     else if (!vm.count("trainingset"))
       wrong = "trainingset";
@@ -92,7 +102,7 @@ main(int argc, char** argv)
     return 1;
   }
 
-  if (!fs::is_directory(svmdir))
+  if (vm.count("svmdir") && !fs::is_directory(svmdir))
   {
     fs::path p(svmdir);
     try
@@ -114,14 +124,31 @@ main(int argc, char** argv)
     return 1;
   }
 
-  ExpressionMatrixProcessor emp(matrixdir);
+  ExpressionMatrixProcessor emp
+    (matrixdir, vm.count("no-mmap") ? ExpressionMatrixProcessor::kStreamedAccess :
+                ExpressionMatrixProcessor::kMappedRandomAccess);
+  emp.setReadAheadRows(readAhead);
   GRNModel m(model, emp);
 
-  std::list<std::string> trainingArrays;
-  m.loadArraySet(trainingset, trainingArrays);
+  ArraySet trainingArrays;
+  if (!trainingArrays.load(emp, trainingset))
+  {
+    std::cout << "Couldn't use the training set " << trainingset << "."
+              << std::endl;
+    return 1;
+  }
   m.setSVMParameters(exp(loggamma), exp(logC), nu);
   m.loadSVMTrainingData(trainingArrays);
-  m.trainAndSaveSVMs(svmdir, dontReplace);
-  
+  if (vm.count("svmdir"))
+    m.trainAndSaveSVMs(svmdir, dontReplace, threads);
+  else
+    m.trainSVMs(threads);
+
+  if (vm.count("svmarchive") && !m.saveSVMArchive(svmarchive))
+  {
+    std::cout << "Couldn't write the SVM archive." << std::endl;
+    return 1;
+  }
+
   return 0;
 }
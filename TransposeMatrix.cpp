@@ -0,0 +1,159 @@
+/*
+    Write the gene-major copy of an expression matrix.
+    Copyright (C) 2008-2009  Andrew Miller
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <boost/program_options.hpp>
+#include <boost/filesystem.hpp>
+#include <iostream>
+#include <cstdio>
+#include "SVMSupport.hpp"
+
+namespace po = boost::program_options;
+namespace fs = boost::filesystem;
+
+// Transposes the array-major data file into genedata, a band of genes at a
+// time, so that the output is written sequentially and only one band needs
+// to be held in memory.
+class MatrixTransposer
+{
+public:
+  MatrixTransposer(const std::string& aMatrixDir, uint32_t aMemoryMB)
+    : mEMP(aMatrixDir, ExpressionMatrixProcessor::kMappedSequentialAccess),
+      mBandWidth(0), mBand(NULL)
+  {
+    uint32_t nArrays = mEMP.getNumArrays();
+    uint64_t budget = static_cast<uint64_t>(aMemoryMB) << 20;
+
+    mBandWidth = budget / (nArrays * sizeof(double));
+    if (mBandWidth == 0)
+      mBandWidth = 1;
+    if (mBandWidth > mEMP.getNumGenes())
+      mBandWidth = mEMP.getNumGenes();
+
+    mBand = new double[static_cast<size_t>(mBandWidth) * nArrays];
+  }
+
+  ~MatrixTransposer()
+  {
+    if (mBand)
+      delete [] mBand;
+  }
+
+  bool
+  writeGeneMajor(const std::string& aFile)
+  {
+    FILE* out = fopen(aFile.c_str(), "w");
+    if (out == NULL)
+      return false;
+
+    uint32_t nGenes = mEMP.getNumGenes(), nArrays = mEMP.getNumArrays();
+    bool ok = true;
+
+    std::vector<uint32_t> all(nArrays);
+    for (uint32_t a = 0; a < nArrays; a++)
+      all[a] = a;
+
+    for (uint32_t first = 0; first < nGenes && ok; first += mBandWidth)
+    {
+      uint32_t width = std::min(mBandWidth, nGenes - first);
+
+      mEMP.startReadAhead(all);
+      for (uint32_t a = 0; a < nArrays; a++)
+      {
+        mEMP.setArray(a);
+        double* p = mBand + a;
+        for (uint32_t g = first; g < first + width; g++, p += nArrays)
+          *p = mEMP.getDataPoint(g);
+      }
+      mEMP.stopReadAhead();
+
+      ok = (fwrite(mBand, sizeof(double) * nArrays, width, out) == width);
+    }
+
+    if (fclose(out) != 0)
+      ok = false;
+
+    return ok;
+  }
+
+private:
+  ExpressionMatrixProcessor mEMP;
+  uint32_t mBandWidth;
+  double* mBand;
+};
+
+int
+main(int argc, char** argv)
+{
+  po::options_description desc;
+  std::string matrixdir;
+  uint32_t memory = 512;
+
+  desc.add_options()
+    ("matrixdir", po::value<std::string>(&matrixdir),
+     "The directory set up by SOFT2Matrix")
+    ("memory", po::value<uint32_t>(&memory),
+     "The amount of memory to transpose in, in megabytes (default 512)")
+    ;
+
+  po::variables_map vm;
+
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  std::string wrong;
+  if (!vm.count("help"))
+  {
+    if (!vm.count("matrixdir"))
+      wrong = "matrixdir";
+  }
+
+  if (wrong != "")
+    std::cerr << "Missing option: " << wrong << std::endl;
+  if (vm.count("help") || wrong != "")
+  {
+    std::cout << desc << std::endl;
+    return 1;
+  }
+
+  if (!fs::is_directory(matrixdir))
+  {
+    std::cout << "Matrix directory doesn't exist."
+              << std::endl;
+    return 1;
+  }
+
+  fs::path target(matrixdir), temporary(matrixdir);
+  target /= "genedata";
+  temporary /= "genedata.tmp";
+
+  // Don't let a stale or half-written copy get picked up while we work.
+  if (fs::exists(target))
+    fs::remove(target);
+
+  MatrixTransposer mt(matrixdir, memory);
+  if (!mt.writeGeneMajor(temporary.string()))
+  {
+    std::cout << "Couldn't write " << temporary.string() << std::endl;
+    fs::remove(temporary);
+    return 1;
+  }
+
+  fs::rename(temporary, target);
+
+  return 0;
+}